@@ -1,5 +1,19 @@
 #Hello World example service
 PRODUCT_PACKAGES += vendor.brcm.helloworld-service
 
+#Hello World service tuning (defaults shown), see HelloWorld.cpp and service.cpp
+# ack: 'enqueue' returns from sayHello once queued, 'durable' once the driver took the message
+# threads: binder thread pool size
+# inherit_rt: a real-time caller's transaction runs at the caller's priority
+# idle_ms: the lazy service exits after this long without clients; keep it well above
+#   the cold-start time it logs ("Cold start: registered N ms after process start")
+# Unset by default: cpus (CPU list, e.g. 2-3), sched and min_sched (fifo:<1-99> or nice:<-20-19>)
+PRODUCT_VENDOR_PROPERTIES += \
+    ro.vendor.helloworld.ack=enqueue \
+    ro.vendor.helloworld.queue_depth=1024 \
+    ro.vendor.helloworld.threads=4 \
+    ro.vendor.helloworld.inherit_rt=true \
+    ro.vendor.helloworld.idle_ms=10000
+
 #Hello World example client
 PRODUCT_PACKAGES += HelloWorld
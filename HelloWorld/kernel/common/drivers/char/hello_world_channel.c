@@ -0,0 +1,307 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * configfs channels of the hello_world driver.
+ *
+ * Every directory created under /config/hello_world is a channel: a queue
+ * of its own (per-CPU rings, drain work item, read log) behind the misc
+ * device /dev/hello_world-<name>. Producers on different channels share
+ * nothing but the message cache and the statistics, and each channel is
+ * sized for its workload before it is enabled:
+ *
+ *   mkdir /config/hello_world/audio
+ *   echo 12 > /config/hello_world/audio/ring_order
+ *   echo 1 > /config/hello_world/audio/priority
+ *   echo 1 > /config/hello_world/audio/enable
+ *
+ * rmdir removes the device at once; the queue goes with the last open file.
+ */
+
+#include <linux/configfs.h>
+#include <linux/kernel.h>
+#include <linux/miscdevice.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/hello_world.h>
+
+#include "hello_world_internal.h"
+
+/*
+ * struct hello_channel - one configfs channel
+ * @item: directory in configfs, its refcount keeps the channel alive
+ * @lock: serialises enabling against the attributes it freezes
+ * @ring_order: log2 of the slots of each per-CPU ring
+ * @priority: 0 drains on hello_wq, 1 on the WQ_HIGHPRI hello_wq_highpri
+ * @enabled: @queue is set up and @dev registered, never cleared
+ * @devname: name of the misc device, "hello_world-<name>"
+ * @queue: messages of the channel
+ * @dev: the channel's misc device
+ */
+struct hello_channel {
+    struct config_item item;
+    struct mutex lock;
+    unsigned int ring_order;
+    unsigned int priority;
+    bool enabled;
+    char *devname;
+    struct hello_queue queue;
+    struct hello_dev dev;
+};
+
+static inline struct hello_channel *to_hello_channel(struct config_item *item)
+{
+    return container_of(item, struct hello_channel, item);
+}
+
+/* Open files of a channel device pin its item, see hello_dev_open() */
+void hello_dev_get(struct hello_dev *dev)
+{
+    config_item_get(dev->item);
+}
+
+void hello_dev_put(struct hello_dev *dev)
+{
+    config_item_put(dev->item);
+}
+
+static ssize_t hello_channel_ring_order_show(struct config_item *item, char *page)
+{
+    return sprintf(page, "%u\n", to_hello_channel(item)->ring_order);
+}
+
+/* Same range as the ring_order module parameter, -EBUSY once enabled */
+static ssize_t hello_channel_ring_order_store(struct config_item *item,
+                                              const char *page, size_t len)
+{
+    struct hello_channel *ch = to_hello_channel(item);
+    unsigned int order;
+    int ret;
+
+    ret = kstrtouint(page, 0, &order);
+    if (ret)
+        return ret;
+    if (order < 1 || order > 16)
+        return -EINVAL;
+
+    mutex_lock(&ch->lock);
+    if (ch->enabled)
+        ret = -EBUSY;
+    else
+        ch->ring_order = order;
+    mutex_unlock(&ch->lock);
+
+    return ret ? ret : len;
+}
+
+static ssize_t hello_channel_priority_show(struct config_item *item, char *page)
+{
+    return sprintf(page, "%u\n", to_hello_channel(item)->priority);
+}
+
+/* 0 or 1, -EBUSY once enabled */
+static ssize_t hello_channel_priority_store(struct config_item *item,
+                                            const char *page, size_t len)
+{
+    struct hello_channel *ch = to_hello_channel(item);
+    unsigned int prio;
+    int ret;
+
+    ret = kstrtouint(page, 0, &prio);
+    if (ret)
+        return ret;
+    if (prio > 1)
+        return -EINVAL;
+
+    mutex_lock(&ch->lock);
+    if (ch->enabled)
+        ret = -EBUSY;
+    else
+        ch->priority = prio;
+    mutex_unlock(&ch->lock);
+
+    return ret ? ret : len;
+}
+
+static ssize_t hello_channel_enable_show(struct config_item *item, char *page)
+{
+    return sprintf(page, "%d\n", READ_ONCE(to_hello_channel(item)->enabled));
+}
+
+/*
+ * hello_channel_enable_store - allocate the queue and register the device
+ *
+ * Only 1 is accepted, a channel is disabled by removing it. Writing 1 to
+ * an enabled channel does nothing.
+ */
+static ssize_t hello_channel_enable_store(struct config_item *item,
+                                          const char *page, size_t len)
+{
+    struct hello_channel *ch = to_hello_channel(item);
+    bool enable;
+    int ret;
+
+    ret = kstrtobool(page, &enable);
+    if (ret)
+        return ret;
+    if (!enable)
+        return -EINVAL;
+
+    /* The queue needs the message cache and workqueues */
+    ret = hello_setup();
+    if (ret)
+        return ret;
+
+    mutex_lock(&ch->lock);
+    if (ch->enabled)
+        goto out;
+
+    ret = hello_queue_init(&ch->queue, ch->ring_order);
+    if (ret)
+        goto out;
+    ch->queue.name = config_item_name(item);
+    if (ch->priority)
+        ch->queue.wq = hello_wq_highpri;
+
+    ret = misc_register(&ch->dev.misc);
+    if (ret) {
+        hello_queue_destroy(&ch->queue);
+        goto out;
+    }
+    WRITE_ONCE(ch->enabled, true);
+out:
+    mutex_unlock(&ch->lock);
+
+    return ret ? ret : len;
+}
+
+/* Messages and bytes waiting for read(), as /sys/kernel/hello_world/pending */
+static ssize_t hello_channel_pending_show(struct config_item *item, char *page)
+{
+    struct hello_channel *ch = to_hello_channel(item);
+
+    if (!READ_ONCE(ch->enabled))
+        return sprintf(page, "0 0\n");
+
+    return sprintf(page, "%u %zu\n", READ_ONCE(ch->queue.log_count),
+                   READ_ONCE(ch->queue.log_bytes));
+}
+
+static ssize_t hello_channel_device_show(struct config_item *item, char *page)
+{
+    return sprintf(page, "%s\n", to_hello_channel(item)->devname);
+}
+
+CONFIGFS_ATTR(hello_channel_, ring_order);
+CONFIGFS_ATTR(hello_channel_, priority);
+CONFIGFS_ATTR(hello_channel_, enable);
+CONFIGFS_ATTR_RO(hello_channel_, pending);
+CONFIGFS_ATTR_RO(hello_channel_, device);
+
+static struct configfs_attribute *hello_channel_attrs[] = {
+    &hello_channel_attr_ring_order,
+    &hello_channel_attr_priority,
+    &hello_channel_attr_enable,
+    &hello_channel_attr_pending,
+    &hello_channel_attr_device,
+    NULL,
+};
+
+/* Last reference gone: no open file and no configfs directory left */
+static void hello_channel_release(struct config_item *item)
+{
+    struct hello_channel *ch = to_hello_channel(item);
+
+    if (ch->enabled)
+        hello_queue_destroy(&ch->queue);
+    kfree(ch->devname);
+    kfree(ch);
+}
+
+static struct configfs_item_operations hello_channel_item_ops = {
+    .release = hello_channel_release,
+};
+
+static const struct config_item_type hello_channel_type = {
+    .ct_item_ops = &hello_channel_item_ops,
+    .ct_attrs = hello_channel_attrs,
+    .ct_owner = THIS_MODULE,
+};
+
+/* mkdir: a disabled channel with the module's default ring size */
+static struct config_item *hello_channel_make(struct config_group *group,
+                                              const char *name)
+{
+    struct hello_channel *ch;
+
+    ch = kzalloc(sizeof(*ch), GFP_KERNEL);
+    if (!ch)
+        return ERR_PTR(-ENOMEM);
+
+    ch->devname = kasprintf(GFP_KERNEL, HELLO_WORLD_DEV_NAME "-%s", name);
+    if (!ch->devname) {
+        kfree(ch);
+        return ERR_PTR(-ENOMEM);
+    }
+
+    mutex_init(&ch->lock);
+    ch->ring_order = hello_ring_order;
+    ch->dev.misc.minor = MISC_DYNAMIC_MINOR;
+    ch->dev.misc.name = ch->devname;
+    ch->dev.misc.fops = &hello_dev_fops;
+    ch->dev.misc.mode = 0600;
+    ch->dev.queue = &ch->queue;
+    ch->dev.item = &ch->item;
+
+    config_item_init_type_name(&ch->item, name, &hello_channel_type);
+    return &ch->item;
+}
+
+/*
+ * rmdir: unregister the device so no new file can be opened, open files
+ * keep the queue until they are closed.
+ */
+static void hello_channel_drop(struct config_group *group, struct config_item *item)
+{
+    struct hello_channel *ch = to_hello_channel(item);
+
+    mutex_lock(&ch->lock);
+    if (ch->enabled)
+        misc_deregister(&ch->dev.misc);
+    mutex_unlock(&ch->lock);
+
+    config_item_put(item);
+}
+
+static struct configfs_group_operations hello_channels_group_ops = {
+    .make_item = hello_channel_make,
+    .drop_item = hello_channel_drop,
+};
+
+static const struct config_item_type hello_channels_type = {
+    .ct_group_ops = &hello_channels_group_ops,
+    .ct_owner = THIS_MODULE,
+};
+
+static struct configfs_subsystem hello_channels_subsys = {
+    .su_group = {
+        .cg_item = {
+            .ci_namebuf = HELLO_WORLD_CONFIGFS_ROOT,
+            .ci_type = &hello_channels_type,
+        },
+    },
+};
+
+int hello_channels_init(void)
+{
+    config_group_init(&hello_channels_subsys.su_group);
+    mutex_init(&hello_channels_subsys.su_mutex);
+
+    return configfs_register_subsystem(&hello_channels_subsys);
+}
+
+/* Every channel holds a module reference, so the subsystem is empty */
+void hello_channels_exit(void)
+{
+    configfs_unregister_subsystem(&hello_channels_subsys);
+}
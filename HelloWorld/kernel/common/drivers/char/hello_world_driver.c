@@ -1,12 +1,249 @@
 #include <linux/kernel.h>
 #include <linux/init.h>
+#include <linux/error-injection.h>
+#include <linux/async.h>
+#include <linux/module.h>
 #include <linux/kobject.h>
 #include <linux/sysfs.h>
 #include <linux/string.h>
 #include <linux/slab.h>
+#include <linux/fs.h>
+#include <linux/ktime.h>
+#include <linux/miscdevice.h>
+#include <linux/mm.h>
+#include <linux/overflow.h>
+#include <linux/poll.h>
+#include <linux/sizes.h>
+#include <linux/moduleparam.h>
+#include <linux/uaccess.h>
+#include <linux/uio.h>
+#include <linux/workqueue.h>
+#include <linux/hello_world.h>
+#include <kunit/visibility.h>
+
+#include "hello_world_internal.h"
+
+#define CREATE_TRACE_POINTS
+#include "hello_world_trace.h"
 
 static struct kobject *hello_kobj;
 
+/* Messages written through sysfs or /dev/hello_world, drained by read() */
+static struct hello_queue hello_queue;
+
+/* Each CPU ring holds 2^ring_order messages, channels may pick their own */
+unsigned int hello_ring_order = 8;
+module_param_named(ring_order, hello_ring_order, uint, 0444);
+MODULE_PARM_DESC(ring_order, "log2 of the number of messages each per-CPU ring can hold");
+
+/* Largest message accepted, the 'hello' attribute is further limited to a page */
+unsigned int hello_msg_max = SZ_64K;
+module_param_named(max_msg_size, hello_msg_max, uint, 0444);
+MODULE_PARM_DESC(max_msg_size, "Largest message in bytes (PAGE_SIZE to 16 MiB)");
+
+/* Messages the drain worker handles per run before yielding */
+unsigned int hello_drain_budget = 64;
+module_param_named(drain_budget, hello_drain_budget, uint, 0644);
+MODULE_PARM_DESC(drain_budget, "Messages moved to the read log per drain worker run");
+
+/* Payload bytes kept for readers before the worker stops draining */
+unsigned int hello_retain_bytes = SZ_1M;
+module_param_named(retain_bytes, hello_retain_bytes, uint, 0644);
+MODULE_PARM_DESC(retain_bytes, "Bytes of drained messages kept for readers of /dev/hello_world");
+
+/* Opt-in: also printk every message when the worker drains it */
+bool hello_debug_printk;
+module_param_named(debug_printk, hello_debug_printk, bool, 0644);
+MODULE_PARM_DESC(debug_printk, "Log every message with printk");
+
+/* Per-sender token bucket, see hello_world_sender.c */
+unsigned int hello_rate_limit;
+module_param_named(rate_limit, hello_rate_limit, uint, 0644);
+MODULE_PARM_DESC(rate_limit, "Messages per second accepted from one process, 0 for no limit");
+
+unsigned int hello_rate_burst = 64;
+module_param_named(rate_burst, hello_rate_burst, uint, 0644);
+MODULE_PARM_DESC(rate_burst, "Messages one process may send back to back before rate_limit applies");
+
+/* Off by default, the read log then holds LZ4 blocks, see hello_world_lz4.c */
+bool hello_compress;
+module_param_named(compress, hello_compress, bool, 0644);
+MODULE_PARM_DESC(compress, "Keep drained batches LZ4-compressed until read (needs CONFIG_HELLO_WORLD_LZ4)");
+
+/* Coalescing of drain worker runs, tuned through the sysfs attributes below */
+unsigned int hello_coalesce_usecs;
+unsigned int hello_coalesce_msgs = 64;
+
+struct workqueue_struct *hello_wq;
+struct workqueue_struct *hello_wq_highpri;
+
+/* Set once hello_setup() allocated the queue, never cleared before exit */
+static bool hello_ready;
+static DEFINE_MUTEX(hello_setup_lock);
+
+/*
+ * hello_setup_locked - allocate the message cache, workqueue and rings
+ *
+ * The expensive part of bringing the driver up, kept out of the initcall.
+ */
+static int hello_setup_locked(void)
+{
+    int retval;
+
+    retval = hello_msg_cache_init();
+    if (retval) {
+        pr_err("hello_world: Failed to create message cache (retval=%d)\n", retval);
+        return retval;
+    }
+
+    /* Before the queue, the drain worker multicasts on the family */
+    retval = hello_genl_init();
+    if (retval) {
+        pr_err("hello_world: Failed to register netlink family (retval=%d)\n", retval);
+        goto err_cache;
+    }
+
+    hello_wq = alloc_workqueue("hello_world", 0, 0);
+    if (!hello_wq) {
+        retval = -ENOMEM;
+        goto err_genl;
+    }
+
+    hello_wq_highpri = alloc_workqueue("hello_world_highpri", WQ_HIGHPRI, 0);
+    if (!hello_wq_highpri) {
+        retval = -ENOMEM;
+        goto err_wq;
+    }
+
+    retval = hello_sender_init();
+    if (retval) {
+        pr_err("hello_world: Failed to create sender table (retval=%d)\n", retval);
+        goto err_wq_highpri;
+    }
+
+    retval = hello_queue_init(&hello_queue, hello_ring_order);
+    if (retval) {
+        pr_err("hello_world: Failed to allocate rings (retval=%d)\n", retval);
+        goto err_sender;
+    }
+    hello_queue.kobj = hello_kobj;
+
+    return 0;
+
+err_sender:
+    hello_sender_exit();
+err_wq_highpri:
+    destroy_workqueue(hello_wq_highpri);
+    hello_wq_highpri = NULL;
+err_wq:
+    destroy_workqueue(hello_wq);
+    hello_wq = NULL;
+err_genl:
+    hello_genl_exit();
+err_cache:
+    hello_msg_cache_destroy();
+    return retval;
+}
+
+/*
+ * hello_setup - make sure the message queue exists
+ *
+ * Called by the async part of init and by every entry point that needs the
+ * queue (the 'hello' attribute, open() of a device and enabling a channel),
+ * so the first user never races with the async setup. Once set up, this is
+ * a single load. A failed setup is retried by the next caller.
+ */
+int hello_setup(void)
+{
+    int retval = 0;
+
+    /* Pairs with the release below */
+    if (likely(smp_load_acquire(&hello_ready)))
+        return 0;
+
+    mutex_lock(&hello_setup_lock);
+    if (!hello_ready) {
+        retval = hello_setup_locked();
+        if (!retval)
+            smp_store_release(&hello_ready, true);
+    }
+    mutex_unlock(&hello_setup_lock);
+
+    return retval;
+}
+
+/*
+ * hello_filter_msg - BPF attach point of every submission
+ * @q: target queue
+ * @data: payload, in kernel memory
+ * @len: payload length
+ *
+ * Called once per message after the size and rate checks, before it is
+ * queued and, where the payload is already in kernel memory (the 'hello'
+ * attribute, shared rings), before it is copied. Does nothing by itself:
+ * fentry/fexit programs can sample or classify messages into maps here,
+ * and an fmod_ret program returning a negative errno drops the message.
+ * A dropped message is counted as filtered and still succeeds for its
+ * writer, like a message lost to a full ring.
+ *
+ * Returns 0 to keep the message.
+ */
+noinline int hello_filter_msg(struct hello_queue *q, const void *data, size_t len)
+{
+    int ret = 0;
+
+    /* No attached program: the call sites must not assume the result */
+    OPTIMIZER_HIDE_VAR(ret);
+    return ret;
+}
+ALLOW_ERROR_INJECTION(hello_filter_msg, ERRNO);
+
+/*
+ * hello_store - queue a kernel buffer as one message
+ * @q: target queue
+ * @buf: payload
+ * @count: payload length
+ *
+ * Copies @buf into a message and queues it; tracing, the opt-in printk
+ * (hello_world.debug_printk=1) and delivery to readers of /dev/hello_world
+ * happen later on the drain worker. A full ring only drops the copy, counted
+ * in rejected_full of the statistics; the write itself still succeeds as it
+ * always has, and so does a message dropped by a BPF filter. Like the
+ * device, an empty message gets -EINVAL and a sender over its rate limit
+ * -EAGAIN.
+ */
+VISIBLE_IF_KUNIT ssize_t hello_store(struct hello_queue *q, const char *buf, size_t count)
+{
+    u64 start = ktime_get_ns();
+    struct hello_msg *msg;
+    int ret;
+
+    if (!count || count > hello_msg_max) {
+        hello_stats_reject(count, -EINVAL);
+        return -EINVAL;
+    }
+
+    ret = hello_sender_charge(task_tgid_nr(current), current->comm, count);
+    if (ret) {
+        hello_queue_skip(q);
+        return ret;
+    }
+
+    if (hello_msg_filtered(q, buf, count))
+        return count;
+
+    msg = hello_msg_alloc(count, GFP_KERNEL);
+    if (!msg)
+        return -ENOMEM;
+
+    memcpy(msg->data, buf, count);
+
+    if (hello_queue_push(q, msg, start))
+        hello_msg_free(msg);
+
+    return count;
+}
+
 /*
  * hello_print - sysfs 'store' callback for 'hello' attribute
  * @kobj: kobject pointer
@@ -14,26 +251,18 @@ static struct kobject *hello_kobj;
  * @buf: user input buffer
  * @count: number of bytes written
  *
- * Copies input to a temporary buffer, logs the received string.
+ * Accepts up to one page, the most sysfs passes to a store callback.
  */
 static ssize_t hello_print(struct kobject *kobj,
                            struct kobj_attribute *attr, const char *buf, size_t count)
 {
-    char tmp[128];
-
-    pr_info("hello_world: hello_print called with count=%zu\n", count);
-
-    if (count >= sizeof(tmp)) {
-        pr_err("hello_world: input too large (%zu bytes), max is %zu\n", count, sizeof(tmp) - 1);
-        return -EINVAL;
-    }
+    int ret;
 
-    strncpy(tmp, buf, count);
-    tmp[count] = '\0';
+    ret = hello_setup();
+    if (ret)
+        return ret;
 
-    pr_info("hello_world received: %s\n", tmp);
-
-    return count;
+    return hello_store(&hello_queue, buf, count);
 }
 
 /* Define a sysfs attribute named 'hello' with write-only permissions */
@@ -43,16 +272,801 @@ static ssize_t hello_print(struct kobject *kobj,
 static struct kobj_attribute hello_attribute =
     __ATTR(hello, 0200, NULL, hello_print);
 
+/*
+ * stats_read - read callback of the binary 'stats' attribute
+ *
+ * Returns a struct hello_world_stats summed over all CPUs at the time of
+ * the read.
+ */
+static ssize_t stats_read(struct file *file, struct kobject *kobj,
+                          struct bin_attribute *attr, char *buf,
+                          loff_t off, size_t count)
+{
+    struct hello_world_stats stats;
+
+    hello_stats_read(&stats);
+
+    return memory_read_from_buffer(buf, count, &off, &stats, sizeof(stats));
+}
+
+/*
+ * pending_show - 'pending' attribute, messages and bytes waiting for read()
+ *
+ * The drain worker calls sysfs_notify() on this attribute whenever it moves
+ * messages to the read log, so it can be poll()ed for POLLPRI.
+ */
+static ssize_t pending_show(struct kobject *kobj, struct kobj_attribute *attr,
+                            char *buf)
+{
+    return sysfs_emit(buf, "%u %zu\n", READ_ONCE(hello_queue.log_count),
+                      READ_ONCE(hello_queue.log_bytes));
+}
+
+static struct kobj_attribute hello_pending_attribute =
+    __ATTR(pending, 0400, pending_show, NULL);
+
+static ssize_t coalesce_usecs_show(struct kobject *kobj, struct kobj_attribute *attr,
+                                   char *buf)
+{
+    return sysfs_emit(buf, "%u\n", READ_ONCE(hello_coalesce_usecs));
+}
+
+/*
+ * coalesce_usecs_store - 'coalesce_usecs' attribute, longest a message waits
+ * for the drain worker, up to a second; 0 (the default) drains at once
+ *
+ * Windows already open keep their deadline.
+ */
+static ssize_t coalesce_usecs_store(struct kobject *kobj, struct kobj_attribute *attr,
+                                    const char *buf, size_t count)
+{
+    unsigned int usecs;
+    int ret;
+
+    ret = kstrtouint(buf, 0, &usecs);
+    if (ret)
+        return ret;
+    if (usecs > USEC_PER_SEC)
+        return -EINVAL;
+
+    WRITE_ONCE(hello_coalesce_usecs, usecs);
+    return count;
+}
+
+static struct kobj_attribute hello_coalesce_usecs_attribute =
+    __ATTR(coalesce_usecs, 0600, coalesce_usecs_show, coalesce_usecs_store);
+
+static ssize_t coalesce_msgs_show(struct kobject *kobj, struct kobj_attribute *attr,
+                                  char *buf)
+{
+    return sysfs_emit(buf, "%u\n", READ_ONCE(hello_coalesce_msgs));
+}
+
+/*
+ * coalesce_msgs_store - 'coalesce_msgs' attribute, messages that close a
+ * coalescing window before its deadline; 0 waits for the deadline only
+ */
+static ssize_t coalesce_msgs_store(struct kobject *kobj, struct kobj_attribute *attr,
+                                   const char *buf, size_t count)
+{
+    unsigned int msgs;
+    int ret;
+
+    ret = kstrtouint(buf, 0, &msgs);
+    if (ret)
+        return ret;
+
+    WRITE_ONCE(hello_coalesce_msgs, msgs);
+    return count;
+}
+
+static struct kobj_attribute hello_coalesce_msgs_attribute =
+    __ATTR(coalesce_msgs, 0600, coalesce_msgs_show, coalesce_msgs_store);
+
+/* Root-only binary attribute, e.g. 'xxd /sys/kernel/hello_world/stats' */
+static struct bin_attribute hello_stats_attribute = {
+    .attr = { .name = "stats", .mode = 0400 },
+    .read = stats_read,
+    .size = sizeof(struct hello_world_stats),
+};
+
+/*
+ * struct hello_file - state of one open /dev/hello_world or channel device
+ * @dev: device the file was opened on
+ * @q: @dev's queue, target of every submission and read on the file
+ * @lock: protects @sring
+ * @sring: shared submission ring, created by the first mmap()
+ * @wake_msgs: read()/poll() wakeup threshold in messages, 0 to ignore
+ * @wake_bytes: read()/poll() wakeup threshold in payload bytes, 0 to ignore
+ * @read_flags: HELLO_READ_F_* of read()
+ * @write_flags: HELLO_WRITE_F_* of write(), batches and memfds
+ * @tag_filter: tag read() and poll() look at, or HELLO_TAG_ANY
+ */
+struct hello_file {
+    struct hello_dev *dev;
+    struct hello_queue *q;
+    struct mutex lock;
+    struct hello_sring *sring;
+    u32 wake_msgs;
+    u32 wake_bytes;
+    u32 read_flags;
+    u32 write_flags;
+    u32 tag_filter;
+};
+
+static bool hello_file_ready(struct hello_file *hf)
+{
+    u32 tag = READ_ONCE(hf->tag_filter);
+
+    if (tag != HELLO_TAG_ANY)
+        return hello_tag_ready(hf->q, tag, READ_ONCE(hf->wake_msgs),
+                               READ_ONCE(hf->wake_bytes));
+
+    return hello_log_ready(hf->q, READ_ONCE(hf->wake_msgs),
+                           READ_ONCE(hf->wake_bytes));
+}
+
+/*
+ * hello_file_tlv - apply HELLO_WRITE_F_TLV to a message written on a file
+ *
+ * Returns 0, or -EBADMSG if the file only takes TLV messages and @msg is
+ * not one.
+ */
+static int hello_file_tlv(struct hello_file *hf, struct hello_msg *msg)
+{
+    if (!(READ_ONCE(hf->write_flags) & HELLO_WRITE_F_TLV))
+        return 0;
+    return hello_msg_set_tlv(msg);
+}
+
+/*
+ * hello_submit_iter - copy one message out of an iov_iter and queue it
+ * @hf: file written to
+ * @from: source, advanced by @len on success
+ * @len: payload length
+ * @user_ns: submit time passed by the writer, 0 if none
+ * @gfp: allocation flags for the message
+ *
+ * Returns 0, -EINVAL if @len is out of range, -EFAULT, -ENOMEM, -EBADMSG for
+ * a malformed TLV message, or -EAGAIN when the caller is over its rate limit
+ * or the ring of its CPU is full.
+ */
+static int hello_submit_iter(struct hello_file *hf, struct iov_iter *from,
+                             size_t len, u64 user_ns, gfp_t gfp)
+{
+    struct hello_queue *q = hf->q;
+    u64 start = ktime_get_ns();
+    struct hello_msg *msg;
+    int ret;
+
+    if (!len || len > hello_msg_max) {
+        hello_stats_reject(len, -EINVAL);
+        return -EINVAL;
+    }
+
+    ret = hello_sender_charge(task_tgid_nr(current), current->comm, len);
+    if (ret) {
+        hello_queue_skip(q);
+        return ret;
+    }
+
+    msg = hello_msg_alloc(len, gfp);
+    if (!msg)
+        return -ENOMEM;
+
+    if (copy_from_iter(msg->data, len, from) != len) {
+        hello_msg_free(msg);
+        return -EFAULT;
+    }
+
+    ret = hello_file_tlv(hf, msg);
+    if (ret) {
+        hello_msg_free(msg);
+        return ret;
+    }
+
+    if (hello_msg_filtered(q, msg->data, len)) {
+        hello_msg_free(msg);
+        return 0;
+    }
+
+    msg->user_ns = user_ns;
+    if (hello_queue_push(q, msg, start)) {
+        hello_msg_free(msg);
+        return -EAGAIN;
+    }
+
+    return 0;
+}
+
+/*
+ * hello_submit_user - copy one message from a user buffer and queue it
+ * @hf: file written to
+ * @ubuf: payload
+ * @len: payload length
+ * @user_ns: submit time passed by the writer, 0 if none
+ *
+ * See hello_submit_iter() for the return values.
+ */
+static int hello_submit_user(struct hello_file *hf, const char __user *ubuf,
+                             size_t len, u64 user_ns)
+{
+    struct iov_iter iter;
+    int ret;
+
+    ret = import_ubuf(ITER_SOURCE, (void __user *)ubuf, len, &iter);
+    if (ret)
+        return ret;
+
+    return hello_submit_iter(hf, &iter, len, user_ns, GFP_KERNEL);
+}
+
+/*
+ * hello_dev_write_iter - write(), writev() and splice() into a device
+ * @iocb: I/O control block
+ * @from: data to queue
+ *
+ * Message boundaries follow the source: write() queues one message and
+ * writev() one per non-empty iovec, so a set of messages costs a single
+ * system call. Data spliced from a pipe has no boundaries and is cut into
+ * messages of up to max_msg_size bytes; splice() calls us again for the
+ * rest. Returns the bytes queued up to the first failure, or its error
+ * (-EAGAIN when the ring of the writer's CPU is full, so the caller can back
+ * off and retry). IOCB_NOWAIT callers never sleep for memory.
+ */
+static ssize_t hello_dev_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+    struct hello_file *hf = iocb->ki_filp->private_data;
+    gfp_t gfp = (iocb->ki_flags & IOCB_NOWAIT) ? GFP_NOWAIT : GFP_KERNEL;
+    ssize_t done = 0;
+    int ret = 0;
+
+    while (iov_iter_count(from)) {
+        size_t len;
+
+        if (user_backed_iter(from))
+            len = iov_iter_single_seg_count(from);
+        else
+            len = min_t(size_t, iov_iter_count(from), hello_msg_max);
+
+        /* Skips empty iovecs, there is a non-empty one further on */
+        if (!len) {
+            iov_iter_advance(from, 0);
+            continue;
+        }
+
+        ret = hello_submit_iter(hf, from, len, 0, gfp);
+        if (ret)
+            break;
+        done += len;
+    }
+
+    return done ? done : ret;
+}
+
+/*
+ * hello_submit_batch - HELLO_IOC_SUBMIT_BATCH handler
+ * @hf: file written to
+ * @argp: user pointer to struct hello_world_batch
+ *
+ * Copies the descriptor array in and the statuses back with one copy each,
+ * so a batch costs a single user/kernel crossing however many messages it
+ * holds. With HELLO_BATCH_USER_TS the array holds struct
+ * hello_world_batch_desc_ts, which carry a submit time each.
+ * Returns the number of messages queued.
+ */
+static long hello_submit_batch(struct hello_file *hf, void __user *argp)
+{
+    struct hello_world_batch_desc_ts *desc_ts;
+    struct hello_world_batch_desc *desc;
+    struct hello_world_batch batch;
+    size_t size, stride;
+    long queued = 0;
+    void *descs;
+    u32 i;
+
+    if (copy_from_user(&batch, argp, sizeof(batch)))
+        return -EFAULT;
+    if (batch.flags & ~(HELLO_BATCH_STOP_ON_ERROR | HELLO_BATCH_USER_TS))
+        return -EINVAL;
+    if (!batch.count)
+        return 0;
+    if (batch.count > HELLO_WORLD_BATCH_MAX)
+        return -E2BIG;
+
+    stride = (batch.flags & HELLO_BATCH_USER_TS) ? sizeof(*desc_ts) : sizeof(*desc);
+    size = array_size(batch.count, stride);
+    descs = memdup_user(u64_to_user_ptr(batch.descs), size);
+    if (IS_ERR(descs))
+        return PTR_ERR(descs);
+
+    for (i = 0; i < batch.count; i++) {
+        u64 user_ns = 0;
+
+        desc = descs + i * stride;
+        if (batch.flags & HELLO_BATCH_USER_TS) {
+            desc_ts = container_of(desc, struct hello_world_batch_desc_ts, desc);
+            user_ns = desc_ts->user_ns;
+        }
+
+        if (queued != i && (batch.flags & HELLO_BATCH_STOP_ON_ERROR)) {
+            desc->status = -ECANCELED;
+            continue;
+        }
+
+        desc->status = hello_submit_user(hf, u64_to_user_ptr(desc->ptr), desc->len,
+                                         user_ns);
+        if (!desc->status)
+            queued++;
+    }
+
+    if (copy_to_user(u64_to_user_ptr(batch.descs), descs, size))
+        queued = -EFAULT;
+    kfree(descs);
+
+    return queued;
+}
+
+/*
+ * hello_submit_memfd - HELLO_IOC_SUBMIT_MEMFD handler
+ * @hf: file written to
+ * @argp: user pointer to struct hello_world_memfd
+ *
+ * Queues the memfd range without copying it. Returns 0, -EOPNOTSUPP if the
+ * driver was built without CONFIG_HELLO_WORLD_MEMFD, -EAGAIN when the caller
+ * is over its rate limit or the ring of its CPU is full, -EBADMSG for a
+ * malformed TLV message, or an error from hello_memfd_msg_get().
+ */
+static long hello_submit_memfd(struct hello_file *hf, void __user *argp)
+{
+    struct hello_queue *q = hf->q;
+    u64 start = ktime_get_ns();
+    struct hello_world_memfd req;
+    struct hello_msg *msg;
+    int ret;
+
+    if (copy_from_user(&req, argp, sizeof(req)))
+        return -EFAULT;
+    if (req.flags)
+        return -EINVAL;
+
+    if (!req.len || req.len > hello_msg_max) {
+        hello_stats_reject(req.len, -EINVAL);
+        return -EINVAL;
+    }
+
+    ret = hello_sender_charge(task_tgid_nr(current), current->comm, req.len);
+    if (ret) {
+        hello_queue_skip(q);
+        return ret;
+    }
+
+    msg = hello_memfd_msg_get(req.fd, req.offset, req.len);
+    if (IS_ERR(msg))
+        return PTR_ERR(msg);
+
+    ret = hello_file_tlv(hf, msg);
+    if (ret) {
+        hello_msg_free(msg);
+        return ret;
+    }
+
+    if (hello_msg_filtered(q, msg->data, msg->len)) {
+        hello_msg_free(msg);
+        return 0;
+    }
+
+    if (hello_queue_push(q, msg, start)) {
+        hello_msg_free(msg);
+        return -EAGAIN;
+    }
+
+    return 0;
+}
+
+/*
+ * hello_copy_rec - copy one message to userspace as a hello_world_rec
+ * @ubuf: destination
+ * @msg: message to copy
+ * @ts: add HELLO_REC_F_TS and a struct hello_world_rec_ts
+ *
+ * Returns the number of bytes written including padding, or -EFAULT.
+ */
+static ssize_t hello_copy_rec(char __user *ubuf, const struct hello_msg *msg, bool ts)
+{
+    static const char pad[HELLO_WORLD_REC_ALIGN];
+    struct hello_world_rec rec = {
+        .seq = msg->seq,
+        .len = msg->len,
+        .cpu = msg->cpu,
+        .flags = msg->flags,
+    };
+    struct hello_world_rec_ts rts = {
+        .accept_ns = msg->ts_ns,
+        .user_ns = msg->user_ns,
+    };
+    size_t hdr = sizeof(rec);
+    size_t size, padded;
+
+    if (ts) {
+        rec.flags |= HELLO_REC_F_TS;
+        hdr += sizeof(rts);
+    }
+    size = hdr + msg->len;
+    padded = ALIGN(size, HELLO_WORLD_REC_ALIGN);
+
+    if (copy_to_user(ubuf, &rec, sizeof(rec)) ||
+        (ts && copy_to_user(ubuf + sizeof(rec), &rts, sizeof(rts))) ||
+        copy_to_user(ubuf + hdr, msg->data, msg->len) ||
+        copy_to_user(ubuf + size, pad, padded - size))
+        return -EFAULT;
+
+    return padded;
+}
+
+/*
+ * hello_dev_read - read() handler of /dev/hello_world
+ * @file: open file
+ * @ubuf: user buffer
+ * @count: size of @ubuf
+ * @ppos: unused, the device is a stream
+ *
+ * Returns as many whole records from the drained log as fit in @ubuf, in
+ * sequence order, or -EINVAL if @ubuf cannot hold even the oldest record.
+ * A file with a tag filter only gets the TLV messages of its tag.
+ * Without O_NONBLOCK the caller sleeps until the file's wakeup threshold is
+ * reached; with it, -EAGAIN is returned if nothing is waiting. Once woken,
+ * everything that fits is returned, not just the threshold.
+ */
+static ssize_t hello_dev_read(struct file *file, char __user *ubuf,
+                              size_t count, loff_t *ppos)
+{
+    struct hello_file *hf = file->private_data;
+    struct hello_queue *q = hf->q;
+    bool ts = READ_ONCE(hf->read_flags) & HELLO_READ_F_TS;
+    u32 tag = READ_ONCE(hf->tag_filter);
+    struct hello_msg *msg;
+    ssize_t done = 0;
+
+again:
+    if (!(file->f_flags & O_NONBLOCK) &&
+        wait_event_interruptible(q->wait, hello_file_ready(hf)))
+        return -ERESTARTSYS;
+
+    if (mutex_lock_interruptible(&q->log_lock))
+        return -ERESTARTSYS;
+
+    for (;;) {
+        size_t size;
+        ssize_t ret;
+
+        if (tag != HELLO_TAG_ANY)
+            msg = hello_tag_first(q, tag);
+        else
+            msg = list_first_entry_or_null(&q->log, struct hello_msg, node);
+        if (!msg)
+            break;
+
+        if (unlikely(msg->flags & HELLO_MSG_F_LZ4)) {
+            /* 0 once a block too big for @ubuf was split or a corrupt one dropped */
+            ret = hello_lz4_read(q, msg, ubuf + done, count - done, ts);
+            if (ret < 0) {
+                if (!done)
+                    done = ret;
+                break;
+            }
+            done += ret;
+            continue;
+        }
+
+        size = hello_rec_size(msg->len, ts);
+
+        if (size > count - done) {
+            if (!done)
+                done = -EINVAL;
+            break;
+        }
+
+        ret = hello_copy_rec(ubuf + done, msg, ts);
+        if (ret < 0) {
+            /* Leave the message queued for the next reader */
+            if (!done)
+                done = ret;
+            break;
+        }
+
+        hello_log_del(q, msg);
+        hello_msg_free(msg);
+        done += ret;
+    }
+
+    mutex_unlock(&q->log_lock);
+
+    /* The worker may have stopped on a full log */
+    if (done > 0)
+        hello_queue_kick(q);
+
+    /* Another reader emptied the log first */
+    if (!done && !(file->f_flags & O_NONBLOCK))
+        goto again;
+
+    return done ? done : -EAGAIN;
+}
+
+/*
+ * hello_dev_poll - poll() handler of /dev/hello_world
+ *
+ * Readable once the file's wakeup threshold is reached. Always writable:
+ * a full ring is reported per message by write() as -EAGAIN.
+ */
+static __poll_t hello_dev_poll(struct file *file, struct poll_table_struct *wait)
+{
+    struct hello_file *hf = file->private_data;
+    __poll_t mask = EPOLLOUT | EPOLLWRNORM;
+
+    poll_wait(file, &hf->q->wait, wait);
+    if (hello_file_ready(hf))
+        mask |= EPOLLIN | EPOLLRDNORM;
+
+    return mask;
+}
+
+/* O_ASYNC: SIGIO whenever the drain worker adds messages to the read log */
+static int hello_dev_fasync(int fd, struct file *file, int on)
+{
+    struct hello_file *hf = file->private_data;
+
+    return fasync_helper(fd, file, on, &hf->q->fasync);
+}
+
+/*
+ * hello_set_wakeup - HELLO_IOC_SET_WAKEUP handler
+ * @hf: file to configure
+ * @argp: user pointer to struct hello_world_wakeup
+ */
+static long hello_set_wakeup(struct hello_file *hf, void __user *argp)
+{
+    struct hello_world_wakeup wk;
+
+    if (copy_from_user(&wk, argp, sizeof(wk)))
+        return -EFAULT;
+
+    if (!wk.msgs && !wk.bytes)
+        wk.msgs = 1;
+    WRITE_ONCE(hf->wake_msgs, wk.msgs);
+    WRITE_ONCE(hf->wake_bytes, wk.bytes);
+
+    /* A lower threshold may already be met */
+    wake_up_interruptible(&hf->q->wait);
+
+    return 0;
+}
+
+/*
+ * hello_set_read_flags - HELLO_IOC_SET_READ_FLAGS handler
+ * @hf: file to configure
+ * @argp: user pointer to a __u32 of HELLO_READ_F_* flags
+ */
+static long hello_set_read_flags(struct hello_file *hf, void __user *argp)
+{
+    u32 flags;
+
+    if (get_user(flags, (u32 __user *)argp))
+        return -EFAULT;
+    if (flags & ~HELLO_READ_F_TS)
+        return -EINVAL;
+
+    WRITE_ONCE(hf->read_flags, flags);
+    return 0;
+}
+
+/*
+ * hello_set_write_flags - HELLO_IOC_SET_WRITE_FLAGS handler
+ * @hf: file to configure
+ * @argp: user pointer to a __u32 of HELLO_WRITE_F_* flags
+ */
+static long hello_set_write_flags(struct hello_file *hf, void __user *argp)
+{
+    u32 flags;
+
+    if (get_user(flags, (u32 __user *)argp))
+        return -EFAULT;
+    if (flags & ~HELLO_WRITE_F_TLV)
+        return -EINVAL;
+
+    WRITE_ONCE(hf->write_flags, flags);
+    return 0;
+}
+
+/*
+ * hello_set_tag_filter - HELLO_IOC_SET_TAG_FILTER handler
+ * @hf: file to configure
+ * @argp: user pointer to a __u32 tag, or HELLO_TAG_ANY
+ */
+static long hello_set_tag_filter(struct hello_file *hf, void __user *argp)
+{
+    u32 tag;
+
+    if (get_user(tag, (u32 __user *)argp))
+        return -EFAULT;
+    if (tag != HELLO_TAG_ANY && tag > U16_MAX)
+        return -EINVAL;
+
+    WRITE_ONCE(hf->tag_filter, tag);
+
+    /* Messages of the new tag may already be waiting */
+    wake_up_interruptible(&hf->q->wait);
+
+    return 0;
+}
+
+/*
+ * hello_dev_open - open() of /dev/hello_world and of every channel device
+ *
+ * misc_open() hands us the miscdevice, which tells the queue apart. It runs
+ * under the misc device lock, so a channel being removed is either still
+ * registered and gets pinned here, or not found at all.
+ */
+static int hello_dev_open(struct inode *inode, struct file *file)
+{
+    struct hello_dev *dev = container_of(file->private_data, struct hello_dev, misc);
+    struct hello_file *hf;
+    int ret;
+
+    /* Everything else on the file relies on the queue */
+    ret = hello_setup();
+    if (ret)
+        return ret;
+
+    hf = kzalloc(sizeof(*hf), GFP_KERNEL);
+    if (!hf)
+        return -ENOMEM;
+
+    hf->dev = dev;
+    hf->q = dev->queue;
+    mutex_init(&hf->lock);
+    hf->wake_msgs = 1;
+    hf->tag_filter = HELLO_TAG_ANY;
+    hello_dev_get(dev);
+    file->private_data = hf;
+
+    return stream_open(inode, file);
+}
+
+/* Called once the last mapping of the shared ring is gone as well */
+static int hello_dev_release(struct inode *inode, struct file *file)
+{
+    struct hello_file *hf = file->private_data;
+
+    hello_dev_fasync(-1, file, 0);
+    if (hf->sring)
+        hello_sring_destroy(hf->sring);
+    /* May free a removed channel, queue included */
+    hello_dev_put(hf->dev);
+    kfree(hf);
+
+    return 0;
+}
+
+/*
+ * hello_dev_mmap - map the shared submission ring
+ * @file: open file
+ * @vma: requested mapping
+ *
+ * The first mapping sizes and allocates the ring of this file, later ones
+ * must ask for the same length. See struct hello_world_sring_hdr.
+ */
+static int hello_dev_mmap(struct file *file, struct vm_area_struct *vma)
+{
+    struct hello_file *hf = file->private_data;
+    int ret;
+
+    if (vma->vm_pgoff || !(vma->vm_flags & VM_SHARED))
+        return -EINVAL;
+
+    mutex_lock(&hf->lock);
+    if (!hf->sring) {
+        struct hello_sring *sr;
+
+        sr = hello_sring_create(hf->q, vma->vm_end - vma->vm_start);
+        if (IS_ERR(sr)) {
+            mutex_unlock(&hf->lock);
+            return PTR_ERR(sr);
+        }
+        hf->sring = sr;
+    }
+    ret = hello_sring_mmap(hf->sring, vma);
+    mutex_unlock(&hf->lock);
+
+    return ret;
+}
+
+static long hello_dev_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+    struct hello_file *hf = file->private_data;
+    long ret = 0;
+
+    switch (cmd) {
+    case HELLO_IOC_SUBMIT_BATCH:
+        return hello_submit_batch(hf, (void __user *)arg);
+    case HELLO_IOC_SRING_KICK:
+        mutex_lock(&hf->lock);
+        if (hf->sring)
+            hello_sring_kick(hf->sring);
+        else
+            ret = -ENXIO;
+        mutex_unlock(&hf->lock);
+        return ret;
+    case HELLO_IOC_SET_WAKEUP:
+        return hello_set_wakeup(hf, (void __user *)arg);
+    case HELLO_IOC_SUBMIT_MEMFD:
+        return hello_submit_memfd(hf, (void __user *)arg);
+    case HELLO_IOC_SET_READ_FLAGS:
+        return hello_set_read_flags(hf, (void __user *)arg);
+    case HELLO_IOC_SET_WRITE_FLAGS:
+        return hello_set_write_flags(hf, (void __user *)arg);
+    case HELLO_IOC_SET_TAG_FILTER:
+        return hello_set_tag_filter(hf, (void __user *)arg);
+    default:
+        return -ENOTTY;
+    }
+}
+
+const struct file_operations hello_dev_fops = {
+    .owner = THIS_MODULE,
+    .open = hello_dev_open,
+    .release = hello_dev_release,
+    .read = hello_dev_read,
+    .write_iter = hello_dev_write_iter,
+    .splice_write = iter_file_splice_write,
+    .poll = hello_dev_poll,
+    .fasync = hello_dev_fasync,
+    .mmap = hello_dev_mmap,
+    .unlocked_ioctl = hello_dev_ioctl,
+    .compat_ioctl = compat_ptr_ioctl,
+    .llseek = no_llseek,
+};
+
+/* /dev/hello_world, root only like the 'hello' attribute */
+static struct hello_dev hello_default_dev = {
+    .misc = {
+        .minor = MISC_DYNAMIC_MINOR,
+        .name = HELLO_WORLD_DEV_NAME,
+        .fops = &hello_dev_fops,
+        .mode = 0600,
+    },
+    .queue = &hello_queue,
+};
+
+static void hello_setup_async(void *data, async_cookie_t cookie)
+{
+    hello_setup();
+}
+
 /*
  * hello_sysfs_init - Module initialization
  *
- * Creates a kobject and sysfs file for 'hello_world'.
+ * Only validates the parameters and registers the sysfs files and
+ * /dev/hello_world, which is cheap; the queue is allocated by an async
+ * function running in parallel with the remaining initcalls. Boot and
+ * module loading still wait for it before userspace can run, so booting
+ * with initcall_debug shows the cost of each half separately. Nothing is
+ * logged on success.
  */
 static int __init hello_sysfs_init(void)
 {
     int retval;
 
-    pr_info("hello_world_sysfs: Initializing sysfs interface\n");
+    if (hello_ring_order < 1 || hello_ring_order > 16) {
+        pr_err("hello_world: ring_order %u out of range [1, 16]\n", hello_ring_order);
+        return -EINVAL;
+    }
+
+    if (hello_msg_max < PAGE_SIZE || hello_msg_max > SZ_16M) {
+        pr_err("hello_world: max_msg_size %u out of range [%lu, %u]\n",
+               hello_msg_max, PAGE_SIZE, SZ_16M);
+        return -EINVAL;
+    }
 
     hello_kobj = kobject_create_and_add("hello_world", kernel_kobj);
     if (!hello_kobj) {
@@ -63,13 +1077,85 @@ static int __init hello_sysfs_init(void)
     retval = sysfs_create_file(hello_kobj, &hello_attribute.attr);
     if (retval) {
         pr_err("hello_world_sysfs: Failed to create sysfs file (retval=%d)\n", retval);
-        kobject_put(hello_kobj);
-    } else {
-        pr_info("hello_world_sysfs: sysfs file created successfully\n");
+        goto err_kobj;
+    }
+
+    retval = sysfs_create_file(hello_kobj, &hello_pending_attribute.attr);
+    if (retval) {
+        pr_err("hello_world: Failed to create pending file (retval=%d)\n", retval);
+        goto err_kobj;
+    }
+
+    retval = sysfs_create_bin_file(hello_kobj, &hello_stats_attribute);
+    if (retval) {
+        pr_err("hello_world: Failed to create stats file (retval=%d)\n", retval);
+        goto err_kobj;
     }
 
-    pr_info("hello_world_sysfs: device_initcall loaded\n");
+    retval = sysfs_create_file(hello_kobj, &hello_coalesce_usecs_attribute.attr);
+    if (!retval)
+        retval = sysfs_create_file(hello_kobj, &hello_coalesce_msgs_attribute.attr);
+    if (retval) {
+        pr_err("hello_world: Failed to create coalesce files (retval=%d)\n", retval);
+        goto err_kobj;
+    }
+
+    retval = misc_register(&hello_default_dev.misc);
+    if (retval) {
+        pr_err("hello_world: Failed to register /dev/%s (retval=%d)\n",
+               HELLO_WORLD_DEV_NAME, retval);
+        goto err_kobj;
+    }
+
+    retval = hello_channels_init();
+    if (retval) {
+        pr_err("hello_world: Failed to register configfs subsystem (retval=%d)\n", retval);
+        goto err_misc;
+    }
+
+    async_schedule(hello_setup_async, NULL);
+
+    pr_debug("hello_world: registered, queue setup deferred\n");
+    return 0;
+
+err_misc:
+    misc_deregister(&hello_default_dev.misc);
+err_kobj:
+    kobject_put(hello_kobj);
     return retval;
 }
 
-device_initcall(hello_sysfs_init);
+/*
+ * hello_sysfs_exit - Module removal
+ *
+ * Open files and channels pin the module, so once the devices and the sysfs
+ * files are gone nothing can reach the queues any more.
+ */
+static void __exit hello_sysfs_exit(void)
+{
+    async_synchronize_full();
+
+    /* Channels pin the module, so none is left */
+    hello_channels_exit();
+    misc_deregister(&hello_default_dev.misc);
+    /* Removes the sysfs files, waiting for writers of 'hello' to return */
+    kobject_del(hello_kobj);
+
+    if (hello_ready) {
+        hello_queue_destroy(&hello_queue);
+        hello_sender_exit();
+        destroy_workqueue(hello_wq_highpri);
+        destroy_workqueue(hello_wq);
+        hello_genl_exit();
+        hello_msg_cache_destroy();
+    }
+
+    /* The drain worker notifies 'pending' on it until the queue is gone */
+    kobject_put(hello_kobj);
+}
+
+module_init(hello_sysfs_init);
+module_exit(hello_sysfs_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("hello_world message driver");
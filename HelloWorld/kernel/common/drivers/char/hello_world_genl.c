@@ -0,0 +1,175 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Generic netlink fan-out of the hello_world driver.
+ *
+ * The drain worker hands every batch it moves to the read log to
+ * hello_genl_emit(), which packs the messages into as few netlink messages
+ * as possible and multicasts them on the "msgs" group. Each batch is
+ * serialised once however many listeners there are, and not at all while
+ * nobody is subscribed.
+ */
+
+#include <kunit/visibility.h>
+#include <linux/kernel.h>
+#include <linux/limits.h>
+#include <linux/list.h>
+#include <linux/string.h>
+#include <net/genetlink.h>
+#include <net/netlink.h>
+#include <linux/hello_world.h>
+
+#include "hello_world_internal.h"
+
+enum {
+    HELLO_GENL_MCGRP_MSGS,
+};
+
+static const struct genl_multicast_group hello_genl_mcgrps[] = {
+    [HELLO_GENL_MCGRP_MSGS] = {
+        .name = HELLO_WORLD_GENL_MCGRP,
+        /* Same audience as the root-only device node */
+        .flags = GENL_MCAST_CAP_SYS_ADMIN,
+    },
+};
+
+static struct genl_family hello_genl_family = {
+    .name = HELLO_WORLD_GENL_NAME,
+    .version = HELLO_WORLD_GENL_VERSION,
+    .maxattr = HELLO_A_MAX,
+    .module = THIS_MODULE,
+    .mcgrps = hello_genl_mcgrps,
+    .n_mcgrps = ARRAY_SIZE(hello_genl_mcgrps),
+};
+
+/*
+ * Largest HELLO_A_MSG but for its payload: the nest header, every
+ * HELLO_MSG_A_* attribute (64-bit ones with their HELLO_MSG_A_PAD) and the
+ * HELLO_MSG_A_DATA header
+ */
+#define HELLO_GENL_MSG_META_MAX                                 \
+    (NLA_HDRLEN +                               /* HELLO_A_MSG */ \
+     3 * (2 * NLA_HDRLEN + sizeof(u64)) +       /* SEQ, TS, USER_TS */ \
+     2 * (NLA_HDRLEN + NLA_ALIGN(sizeof(u16))) + /* CPU, TAG */ \
+     NLA_HDRLEN + sizeof(u32) +                 /* LEN */ \
+     NLA_HDRLEN)                                /* DATA */
+
+int hello_genl_init(void)
+{
+    /* nla_len is 16 bits, a larger nest would silently wrap */
+    BUILD_BUG_ON(HELLO_GENL_MSG_META_MAX + NLA_ALIGN(HELLO_WORLD_GENL_DATA_MAX) > U16_MAX);
+
+    return genl_register_family(&hello_genl_family);
+}
+
+void hello_genl_exit(void)
+{
+    genl_unregister_family(&hello_genl_family);
+}
+
+static size_t hello_genl_msg_size(const struct hello_msg *msg)
+{
+    return nla_total_size(0) +                          /* HELLO_A_MSG */
+           nla_total_size_64bit(sizeof(u64)) +          /* HELLO_MSG_A_SEQ */
+           nla_total_size(sizeof(u16)) +                /* HELLO_MSG_A_CPU */
+           nla_total_size(sizeof(u32)) +                /* HELLO_MSG_A_LEN */
+           nla_total_size_64bit(sizeof(u64)) * 2 +      /* HELLO_MSG_A_TS, _USER_TS */
+           nla_total_size(sizeof(u16)) +                /* HELLO_MSG_A_TAG */
+           nla_total_size(min_t(u32, msg->len, HELLO_WORLD_GENL_DATA_MAX));
+}
+
+/* Returns false, leaving @skb as it was, if @msg does not fit */
+VISIBLE_IF_KUNIT bool hello_genl_put(struct sk_buff *skb, const struct hello_msg *msg)
+{
+    u32 len = min_t(u32, msg->len, HELLO_WORLD_GENL_DATA_MAX);
+    struct nlattr *nest;
+
+    nest = nla_nest_start(skb, HELLO_A_MSG);
+    if (!nest)
+        return false;
+
+    if (nla_put_u64_64bit(skb, HELLO_MSG_A_SEQ, msg->seq, HELLO_MSG_A_PAD) ||
+        nla_put_u16(skb, HELLO_MSG_A_CPU, msg->cpu) ||
+        nla_put_u32(skb, HELLO_MSG_A_LEN, msg->len) ||
+        nla_put_u64_64bit(skb, HELLO_MSG_A_TS, msg->ts_ns, HELLO_MSG_A_PAD) ||
+        (msg->user_ns &&
+         nla_put_u64_64bit(skb, HELLO_MSG_A_USER_TS, msg->user_ns, HELLO_MSG_A_PAD)) ||
+        ((msg->flags & HELLO_REC_F_TLV) &&
+         nla_put_u16(skb, HELLO_MSG_A_TAG, msg->tag)) ||
+        nla_put(skb, HELLO_MSG_A_DATA, len, msg->data)) {
+        nla_nest_cancel(skb, nest);
+        return false;
+    }
+
+    nla_nest_end(skb, nest);
+    return true;
+}
+
+/* Starts a HELLO_CMD_MSGS message in @skb, NULL if it does not fit */
+static void *hello_genl_start(struct sk_buff *skb, const struct hello_queue *q)
+{
+    void *hdr;
+
+    hdr = genlmsg_put(skb, 0, 0, &hello_genl_family, 0, HELLO_CMD_MSGS);
+    if (!hdr)
+        return NULL;
+
+    if (q->name && nla_put_string(skb, HELLO_A_CHANNEL, q->name)) {
+        genlmsg_cancel(skb, hdr);
+        return NULL;
+    }
+
+    return hdr;
+}
+
+static void hello_genl_send(struct sk_buff *skb, void *hdr)
+{
+    genlmsg_end(skb, hdr);
+    /* -ESRCH when the last listener just left, nothing to do either way */
+    genlmsg_multicast(&hello_genl_family, skb, 0, HELLO_GENL_MCGRP_MSGS, GFP_KERNEL);
+}
+
+/*
+ * hello_genl_emit - multicast a batch of drained messages
+ * @q: queue the batch was drained from
+ * @batch: list of struct hello_msg linked by node, in sequence order
+ *
+ * Fills page-sized netlink messages with as many HELLO_A_MSG attributes as
+ * fit and starts a new one when the next does not; a message larger than a
+ * page gets one of its own. Messages of a channel carry its name in
+ * HELLO_A_CHANNEL. Called by the drain worker, which owns @batch.
+ * Listeners that cannot keep up lose messages the usual netlink way
+ * (ENOBUFS on their socket); the driver's own log is unaffected.
+ */
+void hello_genl_emit(struct hello_queue *q, struct list_head *batch)
+{
+    struct sk_buff *skb = NULL;
+    struct hello_msg *msg;
+    void *hdr = NULL;
+    size_t size;
+
+    if (!genl_has_listeners(&hello_genl_family, &init_net, HELLO_GENL_MCGRP_MSGS))
+        return;
+
+    list_for_each_entry(msg, batch, node) {
+        if (skb && hello_genl_put(skb, msg))
+            continue;
+        if (skb)
+            hello_genl_send(skb, hdr);
+
+        size = hello_genl_msg_size(msg);
+        if (q->name)
+            size += nla_total_size(strlen(q->name) + 1);
+        skb = genlmsg_new(max_t(size_t, size, NLMSG_DEFAULT_SIZE), GFP_KERNEL);
+        if (!skb)
+            return;
+
+        hdr = hello_genl_start(skb, q);
+        if (!hdr || !hello_genl_put(skb, msg)) {
+            nlmsg_free(skb);
+            skb = NULL;
+        }
+    }
+
+    if (skb)
+        hello_genl_send(skb, hdr);
+}
@@ -0,0 +1,373 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Shared declarations of the hello_world driver.
+ */
+#ifndef _HELLO_WORLD_INTERNAL_H
+#define _HELLO_WORLD_INTERNAL_H
+
+#include <linux/atomic.h>
+#include <linux/cache.h>
+#include <linux/err.h>
+#include <linux/hrtimer.h>
+#include <linux/list.h>
+#include <linux/miscdevice.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/types.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include <linux/xarray.h>
+#include <linux/hello_world.h>
+
+/* Module parameters, see hello_world_driver.c */
+extern unsigned int hello_ring_order;
+extern unsigned int hello_msg_max;
+extern unsigned int hello_drain_budget;
+extern unsigned int hello_retain_bytes;
+extern bool hello_debug_printk;
+extern unsigned int hello_rate_limit;
+extern unsigned int hello_rate_burst;
+extern bool hello_compress;
+/* Coalescing knobs, see /sys/kernel/hello_world/coalesce_* */
+extern unsigned int hello_coalesce_usecs;
+extern unsigned int hello_coalesce_msgs;
+
+/* Bound workqueue running the drain and shared ring work items */
+extern struct workqueue_struct *hello_wq;
+/* WQ_HIGHPRI twin of hello_wq, drains channels with priority 1 */
+extern struct workqueue_struct *hello_wq_highpri;
+
+/*
+ * struct hello_msg - a message retained by the driver
+ * @seq: sequence number of the queue, assigned when the message is queued
+ * @ts_ns: ktime_get_ns() when the message was queued
+ * @user_ns: submit time passed by the writer, 0 if none
+ * @len: payload length in bytes
+ * @cpu: CPU whose ring the message was queued on
+ * @flags: HELLO_REC_F_*, reported to readers, or HELLO_MSG_F_LZ4
+ * @tag: tag of a HELLO_REC_F_TLV message
+ * @node: entry in hello_queue.log once drained from the rings
+ * @tag_node: entry in the tag's list of hello_queue.tags, TLV messages only
+ * @data: payload, not NUL terminated; points to @buf unless the message
+ *        maps memfd pages (HELLO_REC_F_MEMFD)
+ * @buf: inline payload storage
+ *
+ * Messages with up to HELLO_MSG_SMALL payload bytes come from a dedicated
+ * slab cache backed by a mempool, larger ones from kvmalloc(). @len and
+ * @data select the allocator on free, so they must not change after
+ * allocation.
+ */
+struct hello_msg {
+    u64 seq;
+    u64 ts_ns;
+    u64 user_ns;
+    u32 len;
+    u16 cpu;
+    u16 flags;
+    u16 tag;
+    struct list_head node;
+    struct list_head tag_node;
+    char *data;
+    char buf[];
+};
+
+/* Payload bytes that fit a slab object of the message cache */
+#define HELLO_MSG_SMALL (256 - sizeof(struct hello_msg))
+
+/*
+ * hello_rec_size - bytes a message takes in read()
+ * @len: payload length
+ * @ts: the reader asked for HELLO_READ_F_TS
+ */
+static inline size_t hello_rec_size(size_t len, bool ts)
+{
+    size_t size = sizeof(struct hello_world_rec) + len;
+
+    if (ts)
+        size += sizeof(struct hello_world_rec_ts);
+    return ALIGN(size, HELLO_WORLD_REC_ALIGN);
+}
+
+/*
+ * Driver-internal flag, never reported: the message is an LZ4 block of
+ * several records on a read log, see hello_world_lz4.c
+ */
+#define HELLO_MSG_F_LZ4 0x8000
+
+/*
+ * struct hello_ring - single-producer/single-consumer ring of one CPU
+ * @head: next slot to fill, only written by the owning CPU
+ * @tail: next slot to drain, only written by the consumer
+ * @mask: number of slots minus one
+ * @slots: message pointers
+ *
+ * The producer is the owning CPU with preemption disabled, the consumer is
+ * the drain worker holding hello_queue.read_lock, so neither side takes a
+ * lock.
+ * head and tail live on separate cache lines so that a reader draining
+ * the ring does not bounce the line the writer is updating.
+ */
+struct hello_ring {
+    unsigned int head ____cacheline_aligned_in_smp;
+    unsigned int tail ____cacheline_aligned_in_smp;
+    unsigned int mask;
+    struct hello_msg **slots;
+};
+
+/*
+ * struct hello_queue - per-CPU rings merged into one ordered stream
+ * @rings: one ring per possible CPU
+ * @next_seq: last sequence number handed out
+ * @read_lock: serialises consumers of @rings
+ * @drain_work: moves messages from @rings to @log in batches
+ * @log_lock: protects @log, @log_bytes, @log_count and @tags
+ * @log: drained messages waiting for a reader, in sequence order
+ * @log_bytes: payload bytes on @log
+ * @log_count: messages on @log
+ * @tags: per-tag lists of the TLV messages on @log, see hello_world_tag.c
+ * @wait: readers sleeping in read() or poll()
+ * @fasync: O_ASYNC readers
+ * @kobj: kobject whose 'pending' attribute is notified, may be NULL
+ * @wq: workqueue running @drain_work, hello_wq unless changed after init
+ * @name: channel name reported on netlink, NULL for /dev/hello_world
+ * @flush_timer: coalescing deadline, armed by the first message of a window
+ * @timer_armed: @flush_timer is pending
+ * @coalesced: messages pushed since the drain worker last started
+ *
+ * Writers only push to their CPU ring and kick @drain_work, right away or
+ * once a coalescing window closes (hello_coalesce_usecs). The worker
+ * does the per-message processing (tracing, debug printk) for a whole batch
+ * and stops once @log holds hello_retain_bytes, so an absent reader turns
+ * into full rings instead of unbounded memory use: -EAGAIN for writers of
+ * /dev/hello_world, a drop counted in rejected_full for the 'hello'
+ * attribute.
+ */
+struct hello_queue {
+    struct hello_ring __percpu *rings;
+    atomic64_t next_seq;
+    struct mutex read_lock;
+    struct work_struct drain_work;
+    struct mutex log_lock;
+    struct list_head log;
+    size_t log_bytes;
+    unsigned int log_count;
+    struct xarray tags;
+    wait_queue_head_t wait;
+    struct fasync_struct *fasync;
+    struct kobject *kobj;
+    struct workqueue_struct *wq;
+    const char *name;
+    struct hrtimer flush_timer;
+    atomic_t timer_armed;
+    atomic_t coalesced;
+};
+
+struct config_item;
+
+/*
+ * struct hello_dev - a misc device reading and writing one queue
+ * @misc: the device, its fops are hello_dev_fops
+ * @queue: queue behind the device
+ * @item: configfs item of a channel, pinned by every open file; NULL for
+ *        /dev/hello_world, which lives as long as the module
+ */
+struct hello_dev {
+    struct miscdevice misc;
+    struct hello_queue *queue;
+    struct config_item *item;
+};
+
+extern const struct file_operations hello_dev_fops;
+
+int hello_msg_cache_init(void);
+void hello_msg_cache_destroy(void);
+struct hello_msg *hello_msg_alloc(size_t len, gfp_t gfp);
+void hello_msg_free(struct hello_msg *msg);
+
+#ifdef CONFIG_HELLO_WORLD_MEMFD
+struct hello_msg *hello_memfd_msg_get(int fd, u64 offset, u64 len);
+void hello_memfd_msg_free(struct hello_msg *msg);
+#else
+static inline struct hello_msg *hello_memfd_msg_get(int fd, u64 offset, u64 len)
+{
+    return ERR_PTR(-EOPNOTSUPP);
+}
+
+static inline void hello_memfd_msg_free(struct hello_msg *msg)
+{
+}
+#endif
+
+int hello_queue_init(struct hello_queue *q, unsigned int order);
+void hello_queue_destroy(struct hello_queue *q);
+int hello_queue_push(struct hello_queue *q, struct hello_msg *msg, u64 start_ns);
+
+/*
+ * hello_queue_skip - use up a sequence number for a message @q refused
+ *
+ * For drops decided before hello_queue_push() (rate limit, BPF filter,
+ * shared ring records that could not be queued), so readers see every
+ * dropped message as a gap. Full rings are handled by hello_queue_push().
+ */
+static inline void hello_queue_skip(struct hello_queue *q)
+{
+    atomic64_inc(&q->next_seq);
+}
+struct hello_msg *hello_queue_peek(struct hello_queue *q, struct hello_ring **ringp);
+void hello_queue_advance(struct hello_ring *ring);
+
+void hello_queue_drain(struct work_struct *work);
+void hello_log_del(struct hello_queue *q, struct hello_msg *msg);
+bool hello_log_ready(struct hello_queue *q, u32 wake_msgs, u32 wake_bytes);
+
+/*
+ * hello_wake_ready - check a reader's wakeup threshold
+ * @count: messages waiting for the reader
+ * @bytes: payload bytes waiting for the reader
+ * @log_bytes: payload bytes on the whole log
+ * @wake_msgs: wake at this many waiting messages, 0 to ignore
+ * @wake_bytes: wake at this many waiting payload bytes, 0 to ignore
+ *
+ * A log that reached hello_retain_bytes counts as ready whatever the
+ * thresholds, as it cannot grow any further until someone reads it.
+ */
+static inline bool hello_wake_ready(unsigned int count, size_t bytes, size_t log_bytes,
+                                    u32 wake_msgs, u32 wake_bytes)
+{
+    if (!count)
+        return false;
+    if (!wake_msgs && !wake_bytes)
+        return true;
+
+    return (wake_msgs && count >= wake_msgs) ||
+           (wake_bytes && bytes >= wake_bytes) ||
+           log_bytes >= READ_ONCE(hello_retain_bytes);
+}
+
+int hello_msg_set_tlv(struct hello_msg *msg);
+void hello_tag_add(struct hello_queue *q, struct hello_msg *msg);
+void hello_tag_del(struct hello_queue *q, struct hello_msg *msg);
+struct hello_msg *hello_tag_first(struct hello_queue *q, u16 tag);
+bool hello_tag_ready(struct hello_queue *q, u16 tag, u32 wake_msgs, u32 wake_bytes);
+void hello_tags_destroy(struct hello_queue *q);
+
+/*
+ * hello_queue_kick - make sure the drain worker will run
+ * @q: queue with new messages or new room on its log
+ *
+ * Checks for a pending work item first so that busy writers only read the
+ * shared work item cache line instead of doing an atomic on it.
+ */
+static inline void hello_queue_kick(struct hello_queue *q)
+{
+    if (!work_pending(&q->drain_work))
+        queue_work(q->wq, &q->drain_work);
+}
+
+int hello_setup(void);
+
+#ifdef CONFIG_HELLO_WORLD_CHANNELS
+int hello_channels_init(void);
+void hello_channels_exit(void);
+void hello_dev_get(struct hello_dev *dev);
+void hello_dev_put(struct hello_dev *dev);
+#else
+static inline int hello_channels_init(void)
+{
+    return 0;
+}
+
+static inline void hello_channels_exit(void)
+{
+}
+
+static inline void hello_dev_get(struct hello_dev *dev)
+{
+}
+
+static inline void hello_dev_put(struct hello_dev *dev)
+{
+}
+#endif
+
+#ifdef CONFIG_HELLO_WORLD_LZ4
+size_t hello_lz4_pack(struct list_head *batch, size_t bytes);
+unsigned int hello_lz4_count(const struct hello_msg *block);
+ssize_t hello_lz4_read(struct hello_queue *q, struct hello_msg *block,
+                       char __user *ubuf, size_t room, bool ts);
+#else
+static inline size_t hello_lz4_pack(struct list_head *batch, size_t bytes)
+{
+    return bytes;
+}
+
+static inline unsigned int hello_lz4_count(const struct hello_msg *block)
+{
+    return 1;
+}
+
+static inline ssize_t hello_lz4_read(struct hello_queue *q, struct hello_msg *block,
+                                     char __user *ubuf, size_t room, bool ts)
+{
+    return -EIO;
+}
+#endif
+
+/* Messages that @msg stands for on a read log */
+static inline unsigned int hello_msg_records(const struct hello_msg *msg)
+{
+    if (unlikely(msg->flags & HELLO_MSG_F_LZ4))
+        return hello_lz4_count(msg);
+    return 1;
+}
+
+#if IS_ENABLED(CONFIG_KUNIT)
+/* Exposed to hello_world_test.c */
+struct sk_buff;
+ssize_t hello_store(struct hello_queue *q, const char *buf, size_t count);
+bool hello_genl_put(struct sk_buff *skb, const struct hello_msg *msg);
+#endif
+
+int hello_sender_init(void);
+void hello_sender_exit(void);
+int hello_sender_charge(pid_t tgid, const char *comm, size_t len);
+
+struct hello_world_stats;
+
+void hello_stats_accept(size_t len, u64 lat_ns);
+void hello_stats_reject(size_t len, int err);
+void hello_stats_lz4(size_t raw, size_t stored);
+void hello_stats_lz4_lost(unsigned int count);
+void hello_stats_read(struct hello_world_stats *out);
+
+int hello_filter_msg(struct hello_queue *q, const void *data, size_t len);
+
+/*
+ * hello_msg_filtered - run the BPF filter hook on a message
+ *
+ * Returns true, with the message accounted as filtered, if a program
+ * attached to hello_filter_msg() dropped it.
+ */
+static inline bool hello_msg_filtered(struct hello_queue *q, const void *data, size_t len)
+{
+    if (likely(!hello_filter_msg(q, data, len)))
+        return false;
+
+    hello_queue_skip(q);
+    hello_stats_reject(len, -ECANCELED);
+    return true;
+}
+
+int hello_genl_init(void);
+void hello_genl_exit(void);
+void hello_genl_emit(struct hello_queue *q, struct list_head *batch);
+
+struct vm_area_struct;
+struct hello_sring;
+
+struct hello_sring *hello_sring_create(struct hello_queue *q, size_t map_size);
+void hello_sring_destroy(struct hello_sring *sr);
+int hello_sring_mmap(struct hello_sring *sr, struct vm_area_struct *vma);
+void hello_sring_kick(struct hello_sring *sr);
+
+#endif /* _HELLO_WORLD_INTERNAL_H */
@@ -0,0 +1,143 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Consumer side of the hello_world driver: the drain worker and the log of
+ * messages waiting for a reader.
+ *
+ * Submission only copies a message into the writer's CPU ring and kicks the
+ * drain work item. The worker runs on the bound hello_world workqueue,
+ * merges the rings in sequence order and does the per-message processing
+ * for up to hello_drain_budget messages per run, so the cost is taken out
+ * of the writer's context (e.g. a HAL binder thread) and amortised over a
+ * batch.
+ */
+
+#include <linux/fs.h>
+#include <linux/kernel.h>
+#include <linux/kobject.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/sysfs.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+
+#include "hello_world_internal.h"
+#include "hello_world_trace.h"
+
+static void hello_process(struct hello_msg *msg)
+{
+    trace_hello_world_msg(msg);
+
+    if (READ_ONCE(hello_debug_printk))
+        pr_info("hello_world received: seq=%llu len=%u %.*s\n",
+                msg->seq, msg->len, (int)msg->len, msg->data);
+}
+
+/*
+ * hello_queue_drain - work function of hello_queue.drain_work
+ * @work: the queue's drain_work
+ *
+ * Moves up to hello_drain_budget messages from the rings to the log,
+ * multicasts them on generic netlink, packs them into one LZ4 block if
+ * hello_compress is set, indexes TLV messages by tag, wakes readers once
+ * per batch and requeues itself if the budget ran out. Stops early when the
+ * log is full; readers kick the worker again once they made room.
+ */
+void hello_queue_drain(struct work_struct *work)
+{
+    struct hello_queue *q = container_of(work, struct hello_queue, drain_work);
+    unsigned int budget = max(READ_ONCE(hello_drain_budget), 1U);
+    size_t room = READ_ONCE(hello_retain_bytes);
+    struct hello_ring *ring;
+    struct hello_msg *msg;
+    unsigned int count = 0;
+    size_t bytes = 0;
+    LIST_HEAD(batch);
+
+    /*
+     * Start a new coalescing window. A writer that found the timer armed
+     * in between has published its message before, and the barrier makes
+     * sure the peek below sees it.
+     */
+    atomic_set(&q->coalesced, 0);
+    if (hrtimer_try_to_cancel(&q->flush_timer) == 1)
+        atomic_set(&q->timer_armed, 0);
+    smp_mb();
+
+    /* Unlocked peek at the log size, readers only ever shrink it */
+    if (READ_ONCE(q->log_bytes) >= room)
+        return;
+    room -= READ_ONCE(q->log_bytes);
+
+    mutex_lock(&q->read_lock);
+    while (count < budget && bytes < room) {
+        msg = hello_queue_peek(q, &ring);
+        if (!msg)
+            break;
+        hello_queue_advance(ring);
+
+        hello_process(msg);
+        list_add_tail(&msg->node, &batch);
+        bytes += msg->len;
+        count++;
+    }
+    mutex_unlock(&q->read_lock);
+
+    if (!count)
+        return;
+
+    hello_genl_emit(q, &batch);
+
+    if (READ_ONCE(hello_compress))
+        bytes = hello_lz4_pack(&batch, bytes);
+
+    mutex_lock(&q->log_lock);
+    list_for_each_entry(msg, &batch, node)
+        if (msg->flags & HELLO_REC_F_TLV)
+            hello_tag_add(q, msg);
+    list_splice_tail(&batch, &q->log);
+    WRITE_ONCE(q->log_bytes, q->log_bytes + bytes);
+    WRITE_ONCE(q->log_count, q->log_count + count);
+    mutex_unlock(&q->log_lock);
+
+    /* Sleepers check their own thresholds in hello_log_ready() */
+    wake_up_interruptible(&q->wait);
+    kill_fasync(&q->fasync, SIGIO, POLL_IN);
+    if (q->kobj)
+        sysfs_notify(q->kobj, NULL, "pending");
+
+    if (count == budget)
+        queue_work(q->wq, &q->drain_work);
+}
+
+/*
+ * hello_log_del - take a message off the log
+ * @q: queue, q->log_lock must be held
+ * @msg: message or LZ4 block on q->log, ownership passes to the caller
+ */
+void hello_log_del(struct hello_queue *q, struct hello_msg *msg)
+{
+    lockdep_assert_held(&q->log_lock);
+
+    list_del(&msg->node);
+    if (msg->flags & HELLO_REC_F_TLV)
+        hello_tag_del(q, msg);
+    WRITE_ONCE(q->log_bytes, q->log_bytes - msg->len);
+    WRITE_ONCE(q->log_count, q->log_count - hello_msg_records(msg));
+}
+
+/*
+ * hello_log_ready - check a reader's wakeup threshold
+ * @q: queue
+ * @wake_msgs: wake at this many waiting messages, 0 to ignore
+ * @wake_bytes: wake at this many waiting payload bytes, 0 to ignore
+ *
+ * Lockless, used as a wait_event() and poll() condition, see
+ * hello_wake_ready().
+ */
+bool hello_log_ready(struct hello_queue *q, u32 wake_msgs, u32 wake_bytes)
+{
+    size_t bytes = READ_ONCE(q->log_bytes);
+
+    return hello_wake_ready(READ_ONCE(q->log_count), bytes, bytes,
+                            wake_msgs, wake_bytes);
+}
@@ -0,0 +1,289 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * LZ4 compression of the read logs of the hello_world driver.
+ *
+ * With the compress parameter set, the drain worker serialises each batch
+ * into the records read() returns with HELLO_READ_F_TS (struct
+ * hello_world_rec, struct hello_world_rec_ts, payload, padding) and
+ * compresses them with the kernel's LZ4 library into a single "block"
+ * message flagged HELLO_MSG_F_LZ4. The block stands for
+ * all of its records on the log, so log_count is unchanged, while
+ * log_bytes and therefore retain_bytes count the compressed size: the same
+ * memory holds several times the history for text-like payloads.
+ *
+ * read() decompresses a block straight into the user buffer when all of its
+ * records fit, dropping the timestamps in place for readers that did not
+ * ask for them, and otherwise splits it back into plain messages in place,
+ * so readers see the same records in the same order either way. Batches
+ * that do not shrink are kept as they are, and so are batches holding TLV
+ * messages, which the tag index links one by one.
+ */
+
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/lz4.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+#include <linux/hello_world.h>
+
+#include "hello_world_internal.h"
+
+/*
+ * struct hello_lz4_hdr - start of the payload of a block
+ * @raw_len: size of the records once decompressed
+ * @count: number of records
+ *
+ * Followed by the LZ4 data, up to the block's len.
+ */
+struct hello_lz4_hdr {
+    u32 raw_len;
+    u32 count;
+};
+
+/* Writes @msg to @dst as read() would with timestamps, returns the bytes written */
+static size_t hello_lz4_put_rec(char *dst, const struct hello_msg *msg)
+{
+    struct hello_world_rec rec = {
+        .seq = msg->seq,
+        .len = msg->len,
+        .cpu = msg->cpu,
+        .flags = msg->flags | HELLO_REC_F_TS,
+    };
+    struct hello_world_rec_ts rts = {
+        .accept_ns = msg->ts_ns,
+        .user_ns = msg->user_ns,
+    };
+    size_t size = sizeof(rec) + sizeof(rts) + msg->len;
+    size_t padded = hello_rec_size(msg->len, true);
+
+    memcpy(dst, &rec, sizeof(rec));
+    memcpy(dst + sizeof(rec), &rts, sizeof(rts));
+    memcpy(dst + sizeof(rec) + sizeof(rts), msg->data, msg->len);
+    memset(dst + size, 0, padded - size);
+
+    return padded;
+}
+
+/* Rewrites the records in @raw without timestamps, returns their new size */
+static size_t hello_lz4_strip_ts(char *raw, size_t raw_len)
+{
+    size_t in = 0, out = 0;
+
+    while (in < raw_len) {
+        struct hello_world_rec rec;
+        size_t size;
+
+        memcpy(&rec, raw + in, sizeof(rec));
+        rec.flags &= ~HELLO_REC_F_TS;
+        size = sizeof(rec) + rec.len;
+
+        /* out never passes in, the records only move towards the start */
+        memcpy(raw + out, &rec, sizeof(rec));
+        memmove(raw + out + sizeof(rec),
+                raw + in + sizeof(rec) + sizeof(struct hello_world_rec_ts), rec.len);
+        memset(raw + out + size, 0, hello_rec_size(rec.len, false) - size);
+
+        in += hello_rec_size(rec.len, true);
+        out += hello_rec_size(rec.len, false);
+    }
+
+    return out;
+}
+
+unsigned int hello_lz4_count(const struct hello_msg *block)
+{
+    return ((const struct hello_lz4_hdr *)block->data)->count;
+}
+
+/*
+ * hello_lz4_pack - replace a drained batch by one compressed block
+ * @batch: messages in sequence order, owned by the caller
+ * @bytes: payload bytes of @batch
+ *
+ * Called by the drain worker before the batch is added to the log. On
+ * success @batch holds a single HELLO_MSG_F_LZ4 message; if @batch holds
+ * TLV messages, compression does not pay off or memory is short, @batch is
+ * left alone.
+ * Returns the bytes @batch now accounts for on the log.
+ */
+size_t hello_lz4_pack(struct list_head *batch, size_t bytes)
+{
+    struct hello_msg *msg, *next, *block;
+    struct hello_lz4_hdr *hdr;
+    size_t raw_len = 0, off = 0;
+    unsigned int count = 0;
+    char *raw, *dst;
+    void *wrkmem;
+    int bound, clen;
+
+    list_for_each_entry(msg, batch, node) {
+        if (msg->flags & HELLO_REC_F_TLV)
+            return bytes;
+        raw_len += hello_rec_size(msg->len, true);
+        count++;
+    }
+    if (count < 2 || raw_len > LZ4_MAX_INPUT_SIZE)
+        return bytes;
+
+    bound = LZ4_compressBound(raw_len);
+    raw = kvmalloc(raw_len, GFP_KERNEL);
+    dst = kvmalloc(bound, GFP_KERNEL);
+    wrkmem = kvmalloc(LZ4_MEM_COMPRESS, GFP_KERNEL);
+    if (!raw || !dst || !wrkmem)
+        goto out;
+
+    list_for_each_entry(msg, batch, node)
+        off += hello_lz4_put_rec(raw + off, msg);
+
+    clen = LZ4_compress_default(raw, dst, raw_len, bound, wrkmem);
+    if (clen <= 0 || sizeof(*hdr) + clen >= bytes) {
+        hello_stats_lz4(bytes, bytes);
+        goto out;
+    }
+
+    block = hello_msg_alloc(sizeof(*hdr) + clen, GFP_KERNEL);
+    if (!block)
+        goto out;
+
+    hdr = (struct hello_lz4_hdr *)block->data;
+    hdr->raw_len = raw_len;
+    hdr->count = count;
+    memcpy(block->data + sizeof(*hdr), dst, clen);
+    block->seq = list_first_entry(batch, struct hello_msg, node)->seq;
+    block->flags = HELLO_MSG_F_LZ4;
+
+    list_for_each_entry_safe(msg, next, batch, node) {
+        list_del(&msg->node);
+        hello_msg_free(msg);
+    }
+    list_add(&block->node, batch);
+
+    hello_stats_lz4(bytes, block->len);
+    bytes = block->len;
+out:
+    kvfree(wrkmem);
+    kvfree(dst);
+    kvfree(raw);
+    return bytes;
+}
+
+/*
+ * Replaces @block on the log by plain messages built from the @raw_len
+ * bytes of records at @raw, as packed: with timestamps, so a later
+ * HELLO_READ_F_TS reader still gets them
+ */
+static int hello_lz4_split(struct hello_queue *q, struct hello_msg *block,
+                           const char *raw, size_t raw_len)
+{
+    struct hello_msg *msg, *next;
+    size_t off = 0, bytes = 0;
+    LIST_HEAD(msgs);
+
+    while (off < raw_len) {
+        struct hello_world_rec_ts rts = {};
+        struct hello_world_rec rec;
+        bool ts;
+
+        memcpy(&rec, raw + off, sizeof(rec));
+        ts = rec.flags & HELLO_REC_F_TS;
+        if (ts)
+            memcpy(&rts, raw + off + sizeof(rec), sizeof(rts));
+
+        msg = hello_msg_alloc(rec.len, GFP_KERNEL);
+        if (!msg)
+            goto err;
+
+        msg->seq = rec.seq;
+        msg->ts_ns = rts.accept_ns;
+        msg->user_ns = rts.user_ns;
+        msg->cpu = rec.cpu;
+        msg->flags = rec.flags & ~HELLO_REC_F_TS;
+        memcpy(msg->data, raw + off + sizeof(rec) + (ts ? sizeof(rts) : 0), rec.len);
+        list_add_tail(&msg->node, &msgs);
+
+        bytes += rec.len;
+        off += hello_rec_size(rec.len, ts);
+    }
+
+    /* Same records in the same place, log_count does not change */
+    list_splice(&msgs, &block->node);
+    list_del(&block->node);
+    WRITE_ONCE(q->log_bytes, q->log_bytes - block->len + bytes);
+    hello_msg_free(block);
+    return 0;
+
+err:
+    list_for_each_entry_safe(msg, next, &msgs, node)
+        hello_msg_free(msg);
+    return -ENOMEM;
+}
+
+/*
+ * hello_lz4_read - read() of a block at the head of a log
+ * @q: queue, q->log_lock must be held
+ * @block: first message on q->log, flagged HELLO_MSG_F_LZ4
+ * @ubuf: destination
+ * @room: bytes left in @ubuf
+ * @ts: the reader asked for HELLO_READ_F_TS
+ *
+ * If all records of @block fit in @room they are copied to @ubuf and the
+ * block is freed. Otherwise the block is split into plain messages, which
+ * the caller then reads one by one.
+ * A block that does not decompress is dropped and its messages counted as
+ * lost, the caller carries on with the next message.
+ * Returns the bytes copied, 0 after a split or a drop, or -EFAULT or
+ * -ENOMEM (the block stays queued).
+ */
+ssize_t hello_lz4_read(struct hello_queue *q, struct hello_msg *block,
+                       char __user *ubuf, size_t room, bool ts)
+{
+    const struct hello_lz4_hdr *hdr = (const struct hello_lz4_hdr *)block->data;
+    size_t raw_len = hdr->raw_len, out_len = raw_len;
+    char *raw;
+    ssize_t ret;
+
+    /* Dropping the timestamps removes exactly their size from each record */
+    BUILD_BUG_ON(sizeof(struct hello_world_rec_ts) % HELLO_WORLD_REC_ALIGN);
+    if (!ts)
+        out_len -= (size_t)hdr->count * sizeof(struct hello_world_rec_ts);
+
+    lockdep_assert_held(&q->log_lock);
+
+    raw = kvmalloc(raw_len, GFP_KERNEL);
+    if (!raw)
+        return -ENOMEM;
+
+    ret = LZ4_decompress_safe(block->data + sizeof(*hdr), raw,
+                              block->len - sizeof(*hdr), raw_len);
+    if (ret != raw_len) {
+        pr_warn_ratelimited("hello_world: Dropping corrupt LZ4 block of %u messages (seq %llu)\n",
+                            hdr->count, block->seq);
+        hello_stats_lz4_lost(hdr->count);
+        hello_log_del(q, block);
+        hello_msg_free(block);
+        ret = 0;
+        goto out;
+    }
+
+    /* Split the records as packed, the messages keep their timestamps */
+    if (out_len > room) {
+        ret = hello_lz4_split(q, block, raw, raw_len);
+        goto out;
+    }
+
+    if (!ts)
+        hello_lz4_strip_ts(raw, raw_len);
+
+    if (copy_to_user(ubuf, raw, out_len)) {
+        ret = -EFAULT;
+        goto out;
+    }
+
+    hello_log_del(q, block);
+    hello_msg_free(block);
+    ret = out_len;
+out:
+    kvfree(raw);
+    return ret;
+}
@@ -0,0 +1,157 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Sealed memfd handoff of the hello_world driver.
+ *
+ * HELLO_IOC_SUBMIT_MEMFD queues a message whose payload stays in the pages
+ * of a memfd: the driver takes a reference on each page and maps them into
+ * one contiguous kernel range, so the submission cost no longer grows with
+ * the payload size. The seals are what make this safe; with F_SEAL_WRITE
+ * no writable mapping or write() can exist, and F_SEAL_SHRINK keeps the
+ * range inside the file.
+ *
+ * Everything downstream (tracing, netlink, read()) sees an ordinary
+ * message, msg->data simply points into the mapping.
+ */
+
+#include <linux/file.h>
+#include <linux/fs.h>
+#include <linux/kernel.h>
+#include <linux/memfd.h>
+#include <linux/mm.h>
+#include <linux/overflow.h>
+#include <linux/shmem_fs.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/hello_world.h>
+
+#include "hello_world_internal.h"
+
+/* Seals that make the memfd contents immutable for as long as we map them */
+#define HELLO_MEMFD_SEALS (F_SEAL_WRITE | F_SEAL_SHRINK)
+
+/*
+ * struct hello_memfd_msg - message backed by memfd pages
+ * @vaddr: kernel mapping of @pages
+ * @pages: referenced pages covering the payload
+ * @nr_pages: number of @pages
+ * @msg: the message, msg.data points into @vaddr
+ */
+struct hello_memfd_msg {
+    void *vaddr;
+    struct page **pages;
+    unsigned int nr_pages;
+    struct hello_msg msg;   /* must be last, ends in a flexible array */
+};
+
+static void hello_memfd_put_pages(struct page **pages, unsigned int nr)
+{
+    while (nr--)
+        put_page(pages[nr]);
+    kvfree(pages);
+}
+
+/*
+ * hello_memfd_msg_get - build a message from a range of a sealed memfd
+ * @fd: memfd
+ * @offset: start of the payload
+ * @len: payload length, already checked against hello_msg_max
+ *
+ * Returns the message or an ERR_PTR(): -EBADF, -EINVAL if @fd is not a
+ * shmem memfd or the range lies outside it, -EPERM if a required seal is
+ * missing, or -ENOMEM.
+ */
+struct hello_msg *hello_memfd_msg_get(int fd, u64 offset, u64 len)
+{
+    struct hello_memfd_msg *mmsg;
+    struct page **pages;
+    struct file *file;
+    pgoff_t first;
+    unsigned int nr, i;
+    long seals;
+    u64 end;
+    int ret;
+
+    if (!len || check_add_overflow(offset, len, &end))
+        return ERR_PTR(-EINVAL);
+
+    file = fget(fd);
+    if (!file)
+        return ERR_PTR(-EBADF);
+
+    /* memfd_fcntl() also accepts hugetlbfs memfds, the page lookup does not */
+    ret = -EINVAL;
+    if (!shmem_file(file))
+        goto err_file;
+
+    seals = memfd_fcntl(file, F_GET_SEALS, 0);
+    if (seals < 0) {
+        ret = seals;
+        goto err_file;
+    }
+    ret = -EPERM;
+    if ((seals & HELLO_MEMFD_SEALS) != HELLO_MEMFD_SEALS)
+        goto err_file;
+
+    /* Stable thanks to F_SEAL_SHRINK */
+    ret = -EINVAL;
+    if (end > i_size_read(file_inode(file)))
+        goto err_file;
+
+    first = offset >> PAGE_SHIFT;
+    nr = ((end - 1) >> PAGE_SHIFT) - first + 1;
+
+    ret = -ENOMEM;
+    pages = kvmalloc_array(nr, sizeof(*pages), GFP_KERNEL);
+    if (!pages)
+        goto err_file;
+
+    for (i = 0; i < nr; i++) {
+        struct page *page = shmem_read_mapping_page(file->f_mapping, first + i);
+
+        if (IS_ERR(page)) {
+            ret = PTR_ERR(page);
+            goto err_pages;
+        }
+        pages[i] = page;
+    }
+
+    mmsg = kzalloc(sizeof(*mmsg), GFP_KERNEL);
+    if (!mmsg)
+        goto err_pages;
+
+    mmsg->vaddr = vmap(pages, nr, VM_MAP, PAGE_KERNEL);
+    if (!mmsg->vaddr) {
+        kfree(mmsg);
+        goto err_pages;
+    }
+
+    /* The page references keep the payload alive, not the file */
+    fput(file);
+
+    mmsg->pages = pages;
+    mmsg->nr_pages = nr;
+    mmsg->msg.len = len;
+    mmsg->msg.flags = HELLO_REC_F_MEMFD;
+    mmsg->msg.data = mmsg->vaddr + offset_in_page(offset);
+
+    return &mmsg->msg;
+
+err_pages:
+    hello_memfd_put_pages(pages, i);
+err_file:
+    fput(file);
+    return ERR_PTR(ret);
+}
+
+/*
+ * hello_memfd_msg_free - unmap and release a message from hello_memfd_msg_get()
+ * @msg: message with HELLO_REC_F_MEMFD set
+ */
+void hello_memfd_msg_free(struct hello_msg *msg)
+{
+    struct hello_memfd_msg *mmsg = container_of(msg, struct hello_memfd_msg, msg);
+
+    vunmap(mmsg->vaddr);
+    hello_memfd_put_pages(mmsg->pages, mmsg->nr_pages);
+    kfree(mmsg);
+}
@@ -0,0 +1,323 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Lock-free per-CPU message rings of the hello_world driver.
+ *
+ * Every CPU owns one ring and is its only producer: a writer disables
+ * preemption, claims a sequence number and publishes the message pointer
+ * with a release store of head. Writers on different CPUs therefore never
+ * share a ring cache line, and the sequence counter is the only global
+ * state they touch. The drain worker (hello_world_log.c) merges all rings
+ * by sequence number.
+ */
+
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/mempool.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/smp.h>
+#include <linux/topology.h>
+#include <linux/hello_world.h>
+
+#include "hello_world_internal.h"
+
+/* Elements kept in reserve so small messages survive memory pressure */
+#define HELLO_MSG_POOL_MIN 64
+
+static struct kmem_cache *hello_msg_cache;
+static mempool_t *hello_msg_pool;
+
+/*
+ * hello_msg_cache_init - create the cache and mempool of small messages
+ */
+int hello_msg_cache_init(void)
+{
+    hello_msg_cache = kmem_cache_create("hello_world_msg",
+                                        sizeof(struct hello_msg) + HELLO_MSG_SMALL,
+                                        0, SLAB_HWCACHE_ALIGN, NULL);
+    if (!hello_msg_cache)
+        return -ENOMEM;
+
+    hello_msg_pool = mempool_create_slab_pool(HELLO_MSG_POOL_MIN, hello_msg_cache);
+    if (!hello_msg_pool) {
+        kmem_cache_destroy(hello_msg_cache);
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
+/*
+ * hello_msg_cache_destroy - free the message cache, every message must be freed
+ */
+void hello_msg_cache_destroy(void)
+{
+    mempool_destroy(hello_msg_pool);
+    kmem_cache_destroy(hello_msg_cache);
+}
+
+/*
+ * hello_msg_alloc - allocate a message with room for @len payload bytes
+ * @len: payload length
+ * @gfp: allocation flags for large messages
+ *
+ * Small messages never enter direct reclaim: they come from the slab cache,
+ * or from the mempool reserve when the cache cannot grow without sleeping.
+ * Large messages are allocated with kvmalloc() and @gfp.
+ *
+ * Returns the message with @len filled in, or NULL.
+ */
+struct hello_msg *hello_msg_alloc(size_t len, gfp_t gfp)
+{
+    struct hello_msg *msg;
+
+    if (len <= HELLO_MSG_SMALL)
+        msg = mempool_alloc(hello_msg_pool, (gfp & ~__GFP_DIRECT_RECLAIM) | __GFP_NOWARN);
+    else
+        msg = kvmalloc(struct_size(msg, buf, len), gfp | __GFP_NOWARN);
+    if (!msg) {
+        hello_stats_reject(len, -ENOMEM);
+        return NULL;
+    }
+
+    msg->seq = 0;
+    msg->ts_ns = 0;
+    msg->user_ns = 0;
+    msg->len = len;
+    msg->cpu = 0;
+    msg->flags = 0;
+    msg->tag = 0;
+    msg->data = msg->buf;
+    return msg;
+}
+
+void hello_msg_free(struct hello_msg *msg)
+{
+    if (unlikely(msg->data != msg->buf))
+        hello_memfd_msg_free(msg);
+    else if (msg->len <= HELLO_MSG_SMALL)
+        mempool_free(msg, hello_msg_pool);
+    else
+        kvfree(msg);
+}
+
+/* Deadline of a coalescing window: hand what accumulated to the worker */
+static enum hrtimer_restart hello_queue_flush_timer(struct hrtimer *timer)
+{
+    struct hello_queue *q = container_of(timer, struct hello_queue, flush_timer);
+
+    atomic_set(&q->timer_armed, 0);
+    hello_queue_kick(q);
+    return HRTIMER_NORESTART;
+}
+
+/*
+ * hello_queue_coalesce - run or delay the drain worker after a push
+ * @q: queue a message was just pushed to
+ *
+ * With hello_coalesce_usecs at 0 every push kicks the worker. Otherwise the
+ * first message of a window arms @q->flush_timer that far out, and the
+ * worker only runs once hello_coalesce_msgs messages accumulated or the
+ * timer fires, whichever comes first: a burst costs one worker run and one
+ * reader wakeup, and no message waits for longer than the deadline. The
+ * counter is a shared atomic, which only coalescing queues pay for.
+ */
+static void hello_queue_coalesce(struct hello_queue *q)
+{
+    unsigned int usecs = READ_ONCE(hello_coalesce_usecs);
+    unsigned int msgs = READ_ONCE(hello_coalesce_msgs);
+
+    if (!usecs) {
+        hello_queue_kick(q);
+        return;
+    }
+
+    if (msgs && atomic_inc_return(&q->coalesced) >= msgs) {
+        hello_queue_kick(q);
+        return;
+    }
+
+    /* Full barrier, pairs with the one in hello_queue_drain() */
+    if (!atomic_xchg(&q->timer_armed, 1))
+        hrtimer_start(&q->flush_timer, us_to_ktime(usecs), HRTIMER_MODE_REL);
+}
+
+/*
+ * hello_queue_init - allocate the per-CPU rings of a queue
+ * @q: queue to set up
+ * @order: log2 of the number of slots in each ring
+ */
+int hello_queue_init(struct hello_queue *q, unsigned int order)
+{
+    unsigned int size = 1U << order;
+    int cpu;
+
+    /* hello_queue_destroy() below may tear them down already */
+    xa_init(&q->tags);
+    hrtimer_init(&q->flush_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    q->flush_timer.function = hello_queue_flush_timer;
+    atomic_set(&q->timer_armed, 0);
+    atomic_set(&q->coalesced, 0);
+    q->rings = alloc_percpu(struct hello_ring);
+    if (!q->rings)
+        return -ENOMEM;
+
+    for_each_possible_cpu(cpu) {
+        struct hello_ring *ring = per_cpu_ptr(q->rings, cpu);
+
+        ring->head = 0;
+        ring->tail = 0;
+        ring->mask = size - 1;
+        ring->slots = kcalloc_node(size, sizeof(*ring->slots), GFP_KERNEL,
+                                   cpu_to_node(cpu));
+        if (!ring->slots) {
+            hello_queue_destroy(q);
+            return -ENOMEM;
+        }
+    }
+
+    atomic64_set(&q->next_seq, 0);
+    mutex_init(&q->read_lock);
+    INIT_WORK(&q->drain_work, hello_queue_drain);
+    mutex_init(&q->log_lock);
+    INIT_LIST_HEAD(&q->log);
+    q->log_bytes = 0;
+    q->log_count = 0;
+    init_waitqueue_head(&q->wait);
+    q->fasync = NULL;
+    q->kobj = NULL;
+    q->wq = hello_wq;
+    q->name = NULL;
+    return 0;
+}
+
+/*
+ * hello_queue_destroy - free the rings and every message still queued
+ * @q: queue to tear down, no producer or reader may be running
+ */
+void hello_queue_destroy(struct hello_queue *q)
+{
+    struct hello_msg *msg, *next;
+    int cpu;
+
+    if (!q->rings)
+        return;
+
+    /* The timer queues the work item, so it goes first */
+    hrtimer_cancel(&q->flush_timer);
+    cancel_work_sync(&q->drain_work);
+    list_for_each_entry_safe(msg, next, &q->log, node)
+        hello_msg_free(msg);
+    hello_tags_destroy(q);
+
+    for_each_possible_cpu(cpu) {
+        struct hello_ring *ring = per_cpu_ptr(q->rings, cpu);
+
+        if (!ring->slots)
+            continue;
+        while (ring->tail != ring->head)
+            hello_msg_free(ring->slots[ring->tail++ & ring->mask]);
+        kfree(ring->slots);
+    }
+
+    free_percpu(q->rings);
+    q->rings = NULL;
+}
+
+/*
+ * hello_queue_push - queue a message on the local CPU's ring
+ * @q: target queue
+ * @msg: message to queue, ownership passes to the queue on success
+ * @start_ns: ktime_get_ns() when the caller started submitting @msg
+ *
+ * Assigns the sequence number and accept timestamp, kicks the drain worker
+ * or leaves the message to the coalescing window, and accounts the outcome
+ * in the statistics. Callable from process context
+ * only. The sequence number is taken before the ring is checked, so a
+ * message refused by a full ring leaves a gap readers can see.
+ * Returns 0, or -ENOSPC if the local ring is full.
+ */
+int hello_queue_push(struct hello_queue *q, struct hello_msg *msg, u64 start_ns)
+{
+    size_t len = msg->len;
+    u64 now = ktime_get_ns();
+    struct hello_ring *ring;
+    unsigned int head;
+    int ret = 0;
+    u64 seq;
+
+    ring = get_cpu_ptr(q->rings);
+    seq = atomic64_inc_return(&q->next_seq);
+    head = ring->head;
+    /* Pairs with the release in hello_queue_advance() */
+    if (head - smp_load_acquire(&ring->tail) > ring->mask) {
+        ret = -ENOSPC;
+    } else {
+        msg->seq = seq;
+        msg->ts_ns = now;
+        msg->cpu = smp_processor_id();
+        ring->slots[head & ring->mask] = msg;
+        /* Pairs with the acquire in hello_queue_peek() */
+        smp_store_release(&ring->head, head + 1);
+    }
+    put_cpu_ptr(q->rings);
+
+    /* msg may already be gone, only use its length saved in len */
+    if (ret) {
+        hello_stats_reject(len, ret);
+    } else {
+        hello_queue_coalesce(q);
+        hello_stats_accept(len, now - start_ns);
+    }
+
+    return ret;
+}
+
+/*
+ * hello_queue_peek - find the oldest queued message
+ * @q: queue to look at, q->read_lock must be held
+ * @ringp: set to the ring holding the returned message
+ *
+ * Compares the head message of every CPU ring and returns the one with the
+ * lowest sequence number, or NULL if all rings are empty. The message stays
+ * queued until hello_queue_advance() is called on *@ringp.
+ *
+ * A writer that has claimed a sequence number but not yet published it is
+ * not visible here, so its message may be returned after a later one that
+ * another CPU published first. The window is a few instructions long and
+ * runs with preemption disabled.
+ */
+struct hello_msg *hello_queue_peek(struct hello_queue *q, struct hello_ring **ringp)
+{
+    struct hello_msg *oldest = NULL;
+    int cpu;
+
+    lockdep_assert_held(&q->read_lock);
+
+    for_each_possible_cpu(cpu) {
+        struct hello_ring *ring = per_cpu_ptr(q->rings, cpu);
+        struct hello_msg *msg;
+
+        if (smp_load_acquire(&ring->head) == ring->tail)
+            continue;
+
+        msg = ring->slots[ring->tail & ring->mask];
+        if (!oldest || msg->seq < oldest->seq) {
+            oldest = msg;
+            *ringp = ring;
+        }
+    }
+
+    return oldest;
+}
+
+/*
+ * hello_queue_advance - drop the message returned by hello_queue_peek()
+ * @ring: ring returned through hello_queue_peek()'s @ringp
+ *
+ * The caller takes over ownership of the message.
+ */
+void hello_queue_advance(struct hello_ring *ring)
+{
+    smp_store_release(&ring->tail, ring->tail + 1);
+}
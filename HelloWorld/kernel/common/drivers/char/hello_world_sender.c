@@ -0,0 +1,244 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Per-sender accounting and rate limiting of the hello_world driver.
+ *
+ * Every submission is charged to the sending process (tgid) before any
+ * memory is allocated for it. Senders live in an rhashtable looked up under
+ * RCU, and each carries a token bucket in its GCRA form: a single
+ * "theoretical arrival time" advanced with cmpxchg, so admitting a message
+ * takes no lock and one atomic on the sender's own cache line. A sender
+ * that exceeds hello_rate_limit messages per second, after a burst of
+ * hello_rate_burst, gets -EAGAIN while everyone else is unaffected.
+ *
+ * Senders idle for HELLO_SENDER_IDLE_NS are dropped by a periodic work item;
+ * /sys/kernel/debug/hello_world/senders lists the others in one pass.
+ */
+
+#include <linux/debugfs.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/rhashtable.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/workqueue.h>
+
+#include "hello_world_internal.h"
+
+/* Senders without a submission for this long are forgotten */
+#define HELLO_SENDER_IDLE_NS (60 * NSEC_PER_SEC)
+#define HELLO_SENDER_GC_PERIOD (60 * HZ)
+
+/*
+ * struct hello_sender - accounting of one sending process
+ * @node: entry in hello_senders
+ * @tgid: process, hash key
+ * @comm: process name when first seen
+ * @tat: theoretical arrival time of the next message in ns, see
+ *       hello_sender_admit()
+ * @last_ns: time of the last submission
+ * @msgs: messages admitted
+ * @bytes: payload bytes admitted
+ * @limited: messages refused by the rate limit
+ * @rcu: deferred free
+ */
+struct hello_sender {
+    struct rhash_head node;
+    pid_t tgid;
+    char comm[TASK_COMM_LEN];
+    atomic64_t tat;
+    u64 last_ns;
+    atomic64_t msgs;
+    atomic64_t bytes;
+    atomic64_t limited;
+    struct rcu_head rcu;
+};
+
+static const struct rhashtable_params hello_sender_params = {
+    .key_len = sizeof(pid_t),
+    .key_offset = offsetof(struct hello_sender, tgid),
+    .head_offset = offsetof(struct hello_sender, node),
+    .automatic_shrinking = true,
+};
+
+static struct rhashtable hello_senders;
+static struct dentry *hello_debugfs;
+
+static void hello_sender_gc(struct work_struct *work);
+static DECLARE_DELAYED_WORK(hello_sender_gc_work, hello_sender_gc);
+
+/*
+ * hello_sender_admit - take one token from a sender's bucket
+ * @s: sender
+ * @now: current time in ns
+ *
+ * GCRA: each message moves the theoretical arrival time (TAT) one emission
+ * interval into the future; a message arriving more than burst - 1
+ * intervals before its TAT is over the limit. Equivalent to a token bucket
+ * of hello_rate_burst tokens refilled at hello_rate_limit per second.
+ */
+static bool hello_sender_admit(struct hello_sender *s, u64 now)
+{
+    unsigned int rate = READ_ONCE(hello_rate_limit);
+    unsigned int burst = max(READ_ONCE(hello_rate_burst), 1U);
+    s64 interval, tolerance, tat, next;
+
+    if (!rate)
+        return true;
+
+    interval = div_u64(NSEC_PER_SEC, rate);
+    tolerance = interval * (burst - 1);
+
+    tat = atomic64_read(&s->tat);
+    do {
+        if (tat > (s64)now + tolerance)
+            return false;
+        next = max_t(s64, tat, now) + interval;
+    } while (!atomic64_try_cmpxchg(&s->tat, &tat, next));
+
+    return true;
+}
+
+/* Inserts a sender for @tgid unless one exists; failure only loses accounting */
+static void hello_sender_add(pid_t tgid, const char *comm, u64 now)
+{
+    struct hello_sender *s, *old;
+
+    s = kzalloc(sizeof(*s), GFP_KERNEL);
+    if (!s)
+        return;
+
+    s->tgid = tgid;
+    strscpy(s->comm, comm, sizeof(s->comm));
+    atomic64_set(&s->tat, now);
+    s->last_ns = now;
+
+    old = rhashtable_lookup_get_insert_fast(&hello_senders, &s->node,
+                                            hello_sender_params);
+    if (old) {
+        /* Raced with another thread of the process, or no memory */
+        kfree(s);
+        return;
+    }
+
+    queue_delayed_work(hello_wq, &hello_sender_gc_work, HELLO_SENDER_GC_PERIOD);
+}
+
+/*
+ * hello_sender_charge - account a submission and apply the rate limit
+ * @tgid: sending process
+ * @comm: its name, recorded if this is its first submission
+ * @len: payload length
+ *
+ * Called before the message is allocated. Process context only. A sender
+ * that cannot be tracked (no memory) is let through unlimited.
+ * Returns 0, or -EAGAIN if @tgid is over its rate.
+ */
+int hello_sender_charge(pid_t tgid, const char *comm, size_t len)
+{
+    u64 now = ktime_get_ns();
+    struct hello_sender *s;
+    int ret = 0;
+
+    rcu_read_lock();
+    s = rhashtable_lookup(&hello_senders, &tgid, hello_sender_params);
+    if (unlikely(!s)) {
+        rcu_read_unlock();
+        hello_sender_add(tgid, comm, now);
+        rcu_read_lock();
+        s = rhashtable_lookup(&hello_senders, &tgid, hello_sender_params);
+        if (!s)
+            goto out;
+    }
+
+    WRITE_ONCE(s->last_ns, now);
+    if (hello_sender_admit(s, now)) {
+        atomic64_inc(&s->msgs);
+        atomic64_add(len, &s->bytes);
+    } else {
+        atomic64_inc(&s->limited);
+        ret = -EAGAIN;
+    }
+out:
+    rcu_read_unlock();
+
+    if (ret)
+        hello_stats_reject(len, ret);
+    return ret;
+}
+
+static void hello_sender_gc(struct work_struct *work)
+{
+    u64 cutoff = ktime_get_ns() - HELLO_SENDER_IDLE_NS;
+    struct rhashtable_iter iter;
+    struct hello_sender *s;
+
+    rhashtable_walk_enter(&hello_senders, &iter);
+    rhashtable_walk_start(&iter);
+    while ((s = rhashtable_walk_next(&iter))) {
+        /* -EAGAIN during a resize, the walk just continues */
+        if (IS_ERR(s))
+            continue;
+        if (READ_ONCE(s->last_ns) < cutoff &&
+            !rhashtable_remove_fast(&hello_senders, &s->node, hello_sender_params))
+            kfree_rcu(s, rcu);
+    }
+    rhashtable_walk_stop(&iter);
+    rhashtable_walk_exit(&iter);
+
+    if (atomic_read(&hello_senders.nelems))
+        queue_delayed_work(hello_wq, &hello_sender_gc_work, HELLO_SENDER_GC_PERIOD);
+}
+
+/* debugfs 'senders': one line per sender, header first */
+static int hello_senders_show(struct seq_file *m, void *v)
+{
+    struct rhashtable_iter iter;
+    struct hello_sender *s;
+
+    seq_puts(m, "tgid comm msgs bytes limited\n");
+
+    rhashtable_walk_enter(&hello_senders, &iter);
+    rhashtable_walk_start(&iter);
+    while ((s = rhashtable_walk_next(&iter))) {
+        if (IS_ERR(s))
+            continue;
+        seq_printf(m, "%d %s %lld %lld %lld\n", s->tgid, s->comm,
+                   atomic64_read(&s->msgs), atomic64_read(&s->bytes),
+                   atomic64_read(&s->limited));
+    }
+    rhashtable_walk_stop(&iter);
+    rhashtable_walk_exit(&iter);
+
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(hello_senders);
+
+int hello_sender_init(void)
+{
+    int ret;
+
+    ret = rhashtable_init(&hello_senders, &hello_sender_params);
+    if (ret)
+        return ret;
+
+    /* Debugging aid only, errors are deliberately ignored */
+    hello_debugfs = debugfs_create_dir("hello_world", NULL);
+    debugfs_create_file("senders", 0400, hello_debugfs, NULL, &hello_senders_fops);
+
+    return 0;
+}
+
+static void hello_sender_free(void *ptr, void *arg)
+{
+    kfree(ptr);
+}
+
+/* No submission may be running */
+void hello_sender_exit(void)
+{
+    debugfs_remove_recursive(hello_debugfs);
+    cancel_delayed_work_sync(&hello_sender_gc_work);
+    rhashtable_free_and_destroy(&hello_senders, hello_sender_free, NULL);
+}
@@ -0,0 +1,296 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Shared submission ring of the hello_world driver.
+ *
+ * A process maps the ring from /dev/hello_world and publishes records with
+ * plain stores. A work item copies them into the per-CPU queue. While records
+ * keep arriving the work item requeues itself and the producer never enters
+ * the kernel; only when it finds the ring empty does it set
+ * HELLO_SRING_NEED_WAKEUP and wait for HELLO_IOC_SRING_KICK.
+ *
+ * Everything in the mapping is writable by userspace, so the kernel keeps
+ * its own copy of the consumer position and validates each record header
+ * before using it.
+ */
+
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+#include <linux/hello_world.h>
+
+#include "hello_world_internal.h"
+
+/* Records drained per work item run before yielding the worker */
+#define HELLO_SRING_BUDGET 64
+
+/*
+ * struct hello_sring - kernel side of a shared submission ring
+ * @queue: queue the records are pushed to
+ * @tgid: process that created the ring, charged for its records
+ * @comm: name of @tgid, the records are consumed from a kworker
+ * @hdr: header page, shared with userspace
+ * @data: data area, shared with userspace
+ * @size: size of @data, power of two
+ * @map_size: length of the whole mapping
+ * @msg_max: largest payload accepted, copy of hdr->msg_max
+ * @cons: consumer position, authoritative copy of hdr->cons
+ * @dropped: authoritative copy of hdr->dropped
+ * @broken: a malformed record was seen, the ring is no longer drained
+ * @work: drains the ring, runs on the queue's workqueue
+ */
+struct hello_sring {
+    struct hello_queue *queue;
+    pid_t tgid;
+    char comm[TASK_COMM_LEN];
+    struct hello_world_sring_hdr *hdr;
+    char *data;
+    u32 size;
+    size_t map_size;
+    u32 msg_max;
+    u32 cons;
+    u32 dropped;
+    bool broken;
+    struct work_struct work;
+};
+
+/* Counts a dropped record; skip uses up its sequence number unless push already did */
+static void hello_sring_drop(struct hello_sring *sr, bool skip)
+{
+    if (skip)
+        hello_queue_skip(sr->queue);
+    WRITE_ONCE(sr->hdr->dropped, ++sr->dropped);
+}
+
+static void hello_sring_fail(struct hello_sring *sr)
+{
+    sr->broken = true;
+    WRITE_ONCE(sr->hdr->flags, READ_ONCE(sr->hdr->flags) | HELLO_SRING_ERROR);
+    pr_warn_ratelimited("hello_world: malformed shared ring record, ring disabled\n");
+}
+
+/*
+ * hello_sring_consume - copy the record at sr->cons into the queue
+ * @sr: ring to drain
+ * @avail: bytes published beyond sr->cons
+ *
+ * Returns the number of bytes the record occupies, or 0 if it is malformed.
+ */
+static u32 hello_sring_consume(struct hello_sring *sr, u32 avail)
+{
+    struct hello_world_srec srec;
+    struct hello_msg *msg;
+    u32 off = sr->cons & (sr->size - 1);
+    u32 hdr_size = sizeof(srec);
+    u32 rec_size;
+    u64 start = ktime_get_ns();
+    u64 user_ns = 0;
+    const char *payload;
+
+    /* Records are aligned and the area is a power of two >= one page, so
+     * a header never crosses the end of the data area. */
+    if (avail < sizeof(srec))
+        return 0;
+    memcpy(&srec, sr->data + off, sizeof(srec));
+
+    if (srec.flags & HELLO_SREC_PAD)
+        return sr->size - off <= avail ? sr->size - off : 0;
+
+    if (srec.flags & HELLO_SREC_TS)
+        hdr_size += sizeof(user_ns);
+    if (srec.len > sr->size)
+        return 0;
+    rec_size = ALIGN(hdr_size + srec.len, HELLO_WORLD_REC_ALIGN);
+    if (rec_size > avail || off + rec_size > sr->size)
+        return 0;
+
+    if (srec.flags & HELLO_SREC_TS)
+        memcpy(&user_ns, sr->data + off + sizeof(srec), sizeof(user_ns));
+    payload = sr->data + off + hdr_size;
+
+    if (srec.len > sr->msg_max) {
+        hello_stats_reject(srec.len, -EINVAL);
+        hello_sring_drop(sr, true);
+        return rec_size;
+    }
+
+    /* Over the rate limit: dropped like a record that did not fit */
+    if (hello_sender_charge(sr->tgid, sr->comm, srec.len)) {
+        hello_sring_drop(sr, true);
+        return rec_size;
+    }
+
+    msg = hello_msg_alloc(srec.len, GFP_KERNEL);
+    if (!msg) {
+        hello_sring_drop(sr, true);
+        return rec_size;
+    }
+
+    memcpy(msg->data, payload, srec.len);
+    /* Checked on our copy, userspace can still change the ring */
+    if ((srec.flags & HELLO_SREC_TLV) && hello_msg_set_tlv(msg)) {
+        hello_msg_free(msg);
+        hello_sring_drop(sr, true);
+        return rec_size;
+    }
+
+    /* On our copy as well, so the filter sees what gets queued */
+    if (hello_msg_filtered(sr->queue, msg->data, srec.len)) {
+        hello_msg_free(msg);
+        return rec_size;
+    }
+
+    msg->user_ns = user_ns;
+    if (hello_queue_push(sr->queue, msg, start)) {
+        hello_msg_free(msg);
+        hello_sring_drop(sr, false);
+    }
+
+    return rec_size;
+}
+
+static void hello_sring_work(struct work_struct *work)
+{
+    struct hello_sring *sr = container_of(work, struct hello_sring, work);
+    struct hello_world_sring_hdr *hdr = sr->hdr;
+    unsigned int budget = HELLO_SRING_BUDGET;
+    u32 prod;
+
+    if (sr->broken)
+        return;
+
+    /* The work item never runs concurrently with itself, so it is the only
+     * kernel writer of hdr->flags. */
+    WRITE_ONCE(hdr->flags, READ_ONCE(hdr->flags) & ~HELLO_SRING_NEED_WAKEUP);
+
+    for (;;) {
+        /* Pairs with the producer's release store of prod */
+        prod = smp_load_acquire(&hdr->prod);
+
+        while (sr->cons != prod && budget) {
+            u32 avail = prod - sr->cons;
+            u32 used;
+
+            used = avail <= sr->size ? hello_sring_consume(sr, avail) : 0;
+            if (!used) {
+                hello_sring_fail(sr);
+                break;
+            }
+            sr->cons += used;
+            budget--;
+        }
+
+        /* Hand the space back to the producer */
+        smp_store_release(&hdr->cons, sr->cons);
+
+        if (sr->broken)
+            return;
+        if (!budget) {
+            /* Still busy: stay awake without a doorbell */
+            queue_work(sr->queue->wq, &sr->work);
+            return;
+        }
+
+        /*
+         * Going idle. Publish NEED_WAKEUP before rechecking prod; the
+         * producer stores prod before reading flags, so one of us sees
+         * the other's store.
+         */
+        WRITE_ONCE(hdr->flags, READ_ONCE(hdr->flags) | HELLO_SRING_NEED_WAKEUP);
+        smp_mb();
+        if (READ_ONCE(hdr->prod) == sr->cons)
+            return;
+        WRITE_ONCE(hdr->flags, READ_ONCE(hdr->flags) & ~HELLO_SRING_NEED_WAKEUP);
+    }
+}
+
+/*
+ * hello_sring_create - allocate a shared ring
+ * @q: queue the ring's records are pushed to
+ * @map_size: mmap() length, one header page plus the data area
+ *
+ * Returns the ring or an ERR_PTR().
+ */
+struct hello_sring *hello_sring_create(struct hello_queue *q, size_t map_size)
+{
+    struct hello_sring *sr;
+    size_t size;
+    void *mem;
+
+    if (map_size <= PAGE_SIZE)
+        return ERR_PTR(-EINVAL);
+    size = map_size - PAGE_SIZE;
+    if (!is_power_of_2(size) || size < HELLO_SRING_MIN_SIZE ||
+        size > HELLO_SRING_MAX_SIZE)
+        return ERR_PTR(-EINVAL);
+
+    sr = kzalloc(sizeof(*sr), GFP_KERNEL);
+    if (!sr)
+        return ERR_PTR(-ENOMEM);
+
+    /* Zeroed and suitable for remap_vmalloc_range() */
+    mem = vmalloc_user(map_size);
+    if (!mem) {
+        kfree(sr);
+        return ERR_PTR(-ENOMEM);
+    }
+
+    sr->queue = q;
+    sr->tgid = task_tgid_nr(current);
+    get_task_comm(sr->comm, current);
+    sr->hdr = mem;
+    sr->data = mem + PAGE_SIZE;
+    sr->size = size;
+    sr->map_size = map_size;
+    /* A record must fit the data area along with its header and timestamp */
+    sr->msg_max = min_t(u32, hello_msg_max,
+                        size - sizeof(struct hello_world_srec) - sizeof(__u64));
+    INIT_WORK(&sr->work, hello_sring_work);
+
+    sr->hdr->size = size;
+    sr->hdr->data_off = PAGE_SIZE;
+    sr->hdr->msg_max = sr->msg_max;
+    /* Nothing is draining yet, the first records need a doorbell */
+    sr->hdr->flags = HELLO_SRING_NEED_WAKEUP;
+
+    return sr;
+}
+
+/*
+ * hello_sring_destroy - free a shared ring
+ * @sr: ring to free, no longer mapped anywhere
+ *
+ * Records published but not yet drained are discarded.
+ */
+void hello_sring_destroy(struct hello_sring *sr)
+{
+    cancel_work_sync(&sr->work);
+    vfree(sr->hdr);
+    kfree(sr);
+}
+
+/*
+ * hello_sring_mmap - map a shared ring into a process
+ * @sr: ring to map
+ * @vma: mapping created by mmap()
+ */
+int hello_sring_mmap(struct hello_sring *sr, struct vm_area_struct *vma)
+{
+    if (vma->vm_end - vma->vm_start != sr->map_size)
+        return -EINVAL;
+
+    return remap_vmalloc_range(vma, sr->hdr, 0);
+}
+
+/*
+ * hello_sring_kick - doorbell, start draining after NEED_WAKEUP
+ * @sr: ring to drain
+ */
+void hello_sring_kick(struct hello_sring *sr)
+{
+    if (!sr->broken)
+        queue_work(sr->queue->wq, &sr->work);
+}
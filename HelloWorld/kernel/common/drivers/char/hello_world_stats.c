@@ -0,0 +1,174 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Per-CPU statistics of the hello_world driver.
+ *
+ * Writers only touch their own CPU's counters, with preemption disabled.
+ * Readers of /sys/kernel/hello_world/stats sum all CPUs, so monitoring never
+ * contends with the submission path.
+ */
+
+#include <linux/kernel.h>
+#include <linux/log2.h>
+#include <linux/percpu.h>
+#include <linux/u64_stats_sync.h>
+#include <linux/hello_world.h>
+
+#include "hello_world_internal.h"
+#include "hello_world_trace.h"
+
+struct hello_cpu_stats {
+    u64_stats_t accepted;
+    u64_stats_t bytes;
+    u64_stats_t rejected_too_large;
+    u64_stats_t rejected_full;
+    u64_stats_t rejected_nomem;
+    u64_stats_t lat_hist[HELLO_WORLD_LAT_BUCKETS];
+    u64_stats_t rejected_ratelimited;
+    u64_stats_t lz4_raw_bytes;
+    u64_stats_t lz4_stored_bytes;
+    u64_stats_t filtered;
+    u64_stats_t lz4_lost;
+    struct u64_stats_sync syncp;
+};
+
+static DEFINE_PER_CPU(struct hello_cpu_stats, hello_cpu_stats);
+
+static unsigned int hello_lat_bucket(u64 ns)
+{
+    if (!ns)
+        return 0;
+    return min_t(unsigned int, ilog2(ns), HELLO_WORLD_LAT_BUCKETS - 1);
+}
+
+/*
+ * hello_stats_accept - account a queued message
+ * @len: payload length
+ * @lat_ns: time from entering the submission path until the message was queued
+ */
+void hello_stats_accept(size_t len, u64 lat_ns)
+{
+    struct hello_cpu_stats *s = get_cpu_ptr(&hello_cpu_stats);
+
+    u64_stats_update_begin(&s->syncp);
+    u64_stats_inc(&s->accepted);
+    u64_stats_add(&s->bytes, len);
+    u64_stats_inc(&s->lat_hist[hello_lat_bucket(lat_ns)]);
+    u64_stats_update_end(&s->syncp);
+
+    put_cpu_ptr(&hello_cpu_stats);
+}
+
+/*
+ * hello_stats_reject - account a refused message
+ * @len: payload length
+ * @err: -EINVAL (too large), -ENOSPC (ring full), -EAGAIN (sender over its
+ *       rate limit), -ECANCELED (dropped by a BPF filter) or -ENOMEM
+ *
+ * Also fires the hello_world_reject tracepoint.
+ */
+void hello_stats_reject(size_t len, int err)
+{
+    struct hello_cpu_stats *s;
+
+    trace_hello_world_reject(len, err);
+
+    s = get_cpu_ptr(&hello_cpu_stats);
+    u64_stats_update_begin(&s->syncp);
+    switch (err) {
+    case -EINVAL:
+        u64_stats_inc(&s->rejected_too_large);
+        break;
+    case -ENOSPC:
+        u64_stats_inc(&s->rejected_full);
+        break;
+    case -EAGAIN:
+        u64_stats_inc(&s->rejected_ratelimited);
+        break;
+    case -ECANCELED:
+        u64_stats_inc(&s->filtered);
+        break;
+    default:
+        u64_stats_inc(&s->rejected_nomem);
+        break;
+    }
+    u64_stats_update_end(&s->syncp);
+    put_cpu_ptr(&hello_cpu_stats);
+}
+
+/*
+ * hello_stats_lz4 - account a batch offered to LZ4
+ * @raw: payload bytes of the batch
+ * @stored: bytes retained for it, @raw if it was left uncompressed
+ */
+void hello_stats_lz4(size_t raw, size_t stored)
+{
+    struct hello_cpu_stats *s = get_cpu_ptr(&hello_cpu_stats);
+
+    u64_stats_update_begin(&s->syncp);
+    u64_stats_add(&s->lz4_raw_bytes, raw);
+    u64_stats_add(&s->lz4_stored_bytes, stored);
+    u64_stats_update_end(&s->syncp);
+
+    put_cpu_ptr(&hello_cpu_stats);
+}
+
+/*
+ * hello_stats_lz4_lost - account the messages of a block that was dropped
+ * @count: records the block held
+ */
+void hello_stats_lz4_lost(unsigned int count)
+{
+    struct hello_cpu_stats *s = get_cpu_ptr(&hello_cpu_stats);
+
+    u64_stats_update_begin(&s->syncp);
+    u64_stats_add(&s->lz4_lost, count);
+    u64_stats_update_end(&s->syncp);
+
+    put_cpu_ptr(&hello_cpu_stats);
+}
+
+/*
+ * hello_stats_read - sum the counters of all CPUs
+ * @out: filled with the totals
+ */
+void hello_stats_read(struct hello_world_stats *out)
+{
+    int cpu, i;
+
+    memset(out, 0, sizeof(*out));
+
+    for_each_possible_cpu(cpu) {
+        const struct hello_cpu_stats *s = per_cpu_ptr(&hello_cpu_stats, cpu);
+        struct hello_world_stats snap;
+        unsigned int start;
+
+        do {
+            start = u64_stats_fetch_begin(&s->syncp);
+            snap.accepted = u64_stats_read(&s->accepted);
+            snap.bytes = u64_stats_read(&s->bytes);
+            snap.rejected_too_large = u64_stats_read(&s->rejected_too_large);
+            snap.rejected_full = u64_stats_read(&s->rejected_full);
+            snap.rejected_nomem = u64_stats_read(&s->rejected_nomem);
+            for (i = 0; i < HELLO_WORLD_LAT_BUCKETS; i++)
+                snap.lat_hist[i] = u64_stats_read(&s->lat_hist[i]);
+            snap.rejected_ratelimited = u64_stats_read(&s->rejected_ratelimited);
+            snap.lz4_raw_bytes = u64_stats_read(&s->lz4_raw_bytes);
+            snap.lz4_stored_bytes = u64_stats_read(&s->lz4_stored_bytes);
+            snap.filtered = u64_stats_read(&s->filtered);
+            snap.lz4_lost = u64_stats_read(&s->lz4_lost);
+        } while (u64_stats_fetch_retry(&s->syncp, start));
+
+        out->accepted += snap.accepted;
+        out->bytes += snap.bytes;
+        out->rejected_too_large += snap.rejected_too_large;
+        out->rejected_full += snap.rejected_full;
+        out->rejected_nomem += snap.rejected_nomem;
+        for (i = 0; i < HELLO_WORLD_LAT_BUCKETS; i++)
+            out->lat_hist[i] += snap.lat_hist[i];
+        out->rejected_ratelimited += snap.rejected_ratelimited;
+        out->lz4_raw_bytes += snap.lz4_raw_bytes;
+        out->lz4_stored_bytes += snap.lz4_stored_bytes;
+        out->filtered += snap.filtered;
+        out->lz4_lost += snap.lz4_lost;
+    }
+}
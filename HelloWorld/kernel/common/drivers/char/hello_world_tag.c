@@ -0,0 +1,164 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * TLV messages and the per-tag index of the hello_world read logs.
+ *
+ * A writer that sets HELLO_WRITE_F_TLV on its file (or HELLO_SREC_TLV on a
+ * shared ring record) frames every message as one struct hello_world_tlv
+ * followed by its value. The driver checks the framing from the fixed-size
+ * header alone, the value is opaque binary data, and records the tag.
+ *
+ * Every queue indexes the TLV messages on its log by tag: one list per tag
+ * seen, linked through hello_msg.tag_node, with its own message and byte
+ * counts. A reader that set HELLO_IOC_SET_TAG_FILTER reads and waits on its
+ * tag's list only, so consumers of one tag neither parse nor skip the
+ * records of the others. Lists live until the queue is destroyed; there are
+ * at most 65536 of them.
+ */
+
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/xarray.h>
+#include <linux/hello_world.h>
+
+#include "hello_world_internal.h"
+
+/*
+ * struct hello_tag - TLV messages of one tag on a read log
+ * @msgs: messages in sequence order, linked by hello_msg.tag_node
+ * @count: messages on @msgs
+ * @bytes: payload bytes on @msgs
+ *
+ * Protected by hello_queue.log_lock, @count and @bytes are read locklessly.
+ */
+struct hello_tag {
+    struct list_head msgs;
+    unsigned int count;
+    size_t bytes;
+};
+
+/*
+ * hello_msg_set_tlv - check the TLV framing of a message and record its tag
+ * @msg: message whose payload is already in kernel memory
+ *
+ * The payload must be exactly one struct hello_world_tlv and its value.
+ * Sets HELLO_REC_F_TLV and @msg->tag.
+ * Returns 0, or -EBADMSG if the framing does not match the payload length.
+ */
+int hello_msg_set_tlv(struct hello_msg *msg)
+{
+    struct hello_world_tlv tlv;
+
+    if (msg->len < sizeof(tlv))
+        return -EBADMSG;
+
+    memcpy(&tlv, msg->data, sizeof(tlv));
+    if (tlv.len != msg->len - sizeof(tlv))
+        return -EBADMSG;
+
+    msg->tag = tlv.tag;
+    msg->flags |= HELLO_REC_F_TLV;
+    return 0;
+}
+
+/*
+ * hello_tag_add - index a TLV message added to the log
+ * @q: queue, q->log_lock must be held
+ * @msg: message flagged HELLO_REC_F_TLV, going to the tail of q->log
+ *
+ * If the list of a new tag cannot be allocated, @msg stays unindexed and
+ * only readers without a tag filter see it.
+ */
+void hello_tag_add(struct hello_queue *q, struct hello_msg *msg)
+{
+    struct hello_tag *t;
+
+    lockdep_assert_held(&q->log_lock);
+
+    t = xa_load(&q->tags, msg->tag);
+    if (!t) {
+        t = kzalloc(sizeof(*t), GFP_KERNEL);
+        if (!t)
+            goto unindexed;
+        INIT_LIST_HEAD(&t->msgs);
+        if (xa_err(xa_store(&q->tags, msg->tag, t, GFP_KERNEL))) {
+            kfree(t);
+            goto unindexed;
+        }
+    }
+
+    list_add_tail(&msg->tag_node, &t->msgs);
+    WRITE_ONCE(t->count, t->count + 1);
+    WRITE_ONCE(t->bytes, t->bytes + msg->len);
+    return;
+
+unindexed:
+    INIT_LIST_HEAD(&msg->tag_node);
+}
+
+/*
+ * hello_tag_del - drop a TLV message leaving the log from the index
+ * @q: queue, q->log_lock must be held
+ * @msg: message flagged HELLO_REC_F_TLV, added by hello_tag_add()
+ */
+void hello_tag_del(struct hello_queue *q, struct hello_msg *msg)
+{
+    struct hello_tag *t;
+
+    lockdep_assert_held(&q->log_lock);
+
+    if (list_empty(&msg->tag_node))
+        return;
+
+    t = xa_load(&q->tags, msg->tag);
+    list_del_init(&msg->tag_node);
+    WRITE_ONCE(t->count, t->count - 1);
+    WRITE_ONCE(t->bytes, t->bytes - msg->len);
+}
+
+/*
+ * hello_tag_first - oldest message of a tag on the log
+ * @q: queue, q->log_lock must be held
+ * @tag: tag of the TLV messages
+ *
+ * Returns NULL if no message of @tag is waiting.
+ */
+struct hello_msg *hello_tag_first(struct hello_queue *q, u16 tag)
+{
+    struct hello_tag *t;
+
+    lockdep_assert_held(&q->log_lock);
+
+    t = xa_load(&q->tags, tag);
+    if (!t)
+        return NULL;
+    return list_first_entry_or_null(&t->msgs, struct hello_msg, tag_node);
+}
+
+/*
+ * hello_tag_ready - hello_log_ready() for a reader filtering on @tag
+ *
+ * Lockless: lists are only freed with the queue.
+ */
+bool hello_tag_ready(struct hello_queue *q, u16 tag, u32 wake_msgs, u32 wake_bytes)
+{
+    struct hello_tag *t = xa_load(&q->tags, tag);
+
+    if (!t)
+        return false;
+
+    return hello_wake_ready(READ_ONCE(t->count), READ_ONCE(t->bytes),
+                            READ_ONCE(q->log_bytes), wake_msgs, wake_bytes);
+}
+
+/* Frees the lists of a queue whose log is already empty */
+void hello_tags_destroy(struct hello_queue *q)
+{
+    struct hello_tag *t;
+    unsigned long tag;
+
+    xa_for_each(&q->tags, tag, t)
+        kfree(t);
+    xa_destroy(&q->tags);
+}
@@ -0,0 +1,685 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * KUnit tests and microbenchmarks of the hello_world driver.
+ *
+ * Every test runs against a private queue, so the driver's own queue and its
+ * readers are left alone; the message cache and the hello_world workqueue
+ * are shared with the driver. Run on any Linux box with
+ *
+ *   ./tools/testing/kunit/kunit.py run --kunitconfig=drivers/char
+ *
+ * The benchmarks print one "ns/op" line per message size and never fail;
+ * compare them between builds to spot regressions of the store path.
+ */
+
+#include <kunit/test.h>
+#include <linux/delay.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/mutex.h>
+#include <linux/sched.h>
+#include <linux/skbuff.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/workqueue.h>
+#include <net/netlink.h>
+
+#include "hello_world_internal.h"
+
+/* 16 slots per CPU, small enough to fill from a test */
+#define HELLO_TEST_RING_ORDER 4
+
+/* Messages stored per timed batch, then drained outside the timing */
+#define HELLO_BENCH_BATCH 64
+#define HELLO_BENCH_BATCHES 64
+
+static int hello_test_init(struct kunit *test)
+{
+    struct hello_queue *q;
+
+    /* The message cache and workqueue are set up lazily */
+    if (hello_setup())
+        kunit_skip(test, "hello_world setup failed");
+
+    q = kunit_kzalloc(test, sizeof(*q), GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, q);
+    KUNIT_ASSERT_EQ(test, hello_queue_init(q, HELLO_TEST_RING_ORDER), 0);
+
+    test->priv = q;
+    return 0;
+}
+
+static void hello_test_exit(struct kunit *test)
+{
+    struct hello_queue *q = test->priv;
+
+    if (q)
+        hello_queue_destroy(q);
+}
+
+/* Wait until the drain worker has moved everything it can to the log */
+static void hello_test_drain(struct hello_queue *q)
+{
+    /* The worker requeues itself after a full budget */
+    while (flush_work(&q->drain_work))
+        ;
+}
+
+/* Take the oldest message off the log, caller frees it */
+static struct hello_msg *hello_test_pop(struct hello_queue *q)
+{
+    struct hello_msg *msg;
+
+    mutex_lock(&q->log_lock);
+    msg = list_first_entry_or_null(&q->log, struct hello_msg, node);
+    if (msg)
+        hello_log_del(q, msg);
+    mutex_unlock(&q->log_lock);
+
+    return msg;
+}
+
+static void hello_test_flush_log(struct hello_queue *q)
+{
+    struct hello_msg *msg;
+
+    hello_test_drain(q);
+    while ((msg = hello_test_pop(q)))
+        hello_msg_free(msg);
+}
+
+static void hello_test_store_bounds(struct kunit *test)
+{
+    const size_t sizes[] = {
+        1, HELLO_MSG_SMALL, HELLO_MSG_SMALL + 1, PAGE_SIZE, hello_msg_max,
+    };
+    struct hello_queue *q = test->priv;
+    struct hello_msg *msg;
+    char *buf;
+    int i;
+
+    buf = kunit_kmalloc(test, hello_msg_max + 1, GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, buf);
+    for (i = 0; i <= hello_msg_max; i++)
+        buf[i] = 'a' + i % 26;
+
+    for (i = 0; i < ARRAY_SIZE(sizes); i++)
+        KUNIT_EXPECT_EQ(test, hello_store(q, buf, sizes[i]), (ssize_t)sizes[i]);
+    /* Out of range, as for the device */
+    KUNIT_EXPECT_EQ(test, hello_store(q, buf, 0), (ssize_t)-EINVAL);
+    KUNIT_EXPECT_EQ(test, hello_store(q, buf, hello_msg_max + 1), (ssize_t)-EINVAL);
+
+    hello_test_drain(q);
+    KUNIT_EXPECT_EQ(test, READ_ONCE(q->log_count), ARRAY_SIZE(sizes));
+
+    for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+        msg = hello_test_pop(q);
+        KUNIT_ASSERT_NOT_NULL(test, msg);
+        KUNIT_EXPECT_EQ(test, msg->len, (u32)sizes[i]);
+        KUNIT_EXPECT_EQ(test, memcmp(msg->data, buf, msg->len), 0);
+        hello_msg_free(msg);
+    }
+    KUNIT_EXPECT_NULL(test, hello_test_pop(q));
+    KUNIT_EXPECT_EQ(test, READ_ONCE(q->log_bytes), 0);
+}
+
+static void hello_test_order(struct kunit *test)
+{
+    const int count = 1 << HELLO_TEST_RING_ORDER;
+    unsigned int saved = hello_drain_budget;
+    struct hello_queue *q = test->priv;
+    struct hello_msg *msg;
+    char buf[16];
+    u64 last = 0;
+    int i, len;
+
+    /* A small budget makes the worker requeue itself several times */
+    WRITE_ONCE(hello_drain_budget, 4);
+    for (i = 0; i < count; i++) {
+        len = scnprintf(buf, sizeof(buf), "%d", i);
+        KUNIT_EXPECT_EQ(test, hello_store(q, buf, len), (ssize_t)len);
+    }
+    hello_test_drain(q);
+    WRITE_ONCE(hello_drain_budget, saved);
+
+    for (i = 0; (msg = hello_test_pop(q)); i++) {
+        len = scnprintf(buf, sizeof(buf), "%d", i);
+        KUNIT_EXPECT_GT(test, msg->seq, last);
+        KUNIT_EXPECT_EQ(test, msg->len, (u32)len);
+        KUNIT_EXPECT_EQ(test, memcmp(msg->data, buf, len), 0);
+        last = msg->seq;
+        hello_msg_free(msg);
+    }
+    KUNIT_EXPECT_EQ(test, i, count);
+}
+
+static void hello_test_timestamps(struct kunit *test)
+{
+    struct hello_queue *q = test->priv;
+    struct hello_msg *msg;
+    u64 before, after, last_seq = 0, last_ts = 0;
+    int i;
+
+    before = ktime_get_ns();
+    for (i = 0; i < 4; i++)
+        KUNIT_EXPECT_EQ(test, hello_store(q, "ts", 2), (ssize_t)2);
+    after = ktime_get_ns();
+    hello_test_drain(q);
+
+    /* Consecutive sequence numbers and ordered accept times */
+    for (i = 0; (msg = hello_test_pop(q)); i++) {
+        if (last_seq)
+            KUNIT_EXPECT_EQ(test, msg->seq, last_seq + 1);
+        KUNIT_EXPECT_GE(test, msg->ts_ns, max(before, last_ts));
+        KUNIT_EXPECT_LE(test, msg->ts_ns, after);
+        KUNIT_EXPECT_EQ(test, msg->user_ns, 0);
+        last_seq = msg->seq;
+        last_ts = msg->ts_ns;
+        hello_msg_free(msg);
+    }
+    KUNIT_EXPECT_EQ(test, i, 4);
+}
+
+static void hello_test_ring_full(struct kunit *test)
+{
+    const int slots = 1 << HELLO_TEST_RING_ORDER;
+    struct hello_queue *q = test->priv;
+    struct hello_msg *msgs[(1 << HELLO_TEST_RING_ORDER) + 1];
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(msgs); i++) {
+        msgs[i] = hello_msg_alloc(1, GFP_KERNEL);
+        KUNIT_ASSERT_NOT_NULL(test, msgs[i]);
+    }
+
+    /* Keep the worker out of the rings and all pushes on one CPU ring */
+    mutex_lock(&q->read_lock);
+    migrate_disable();
+    for (i = 0; i < slots; i++)
+        KUNIT_EXPECT_EQ(test, hello_queue_push(q, msgs[i], ktime_get_ns()), 0);
+    KUNIT_EXPECT_EQ(test, hello_queue_push(q, msgs[slots], ktime_get_ns()), -ENOSPC);
+    migrate_enable();
+    mutex_unlock(&q->read_lock);
+
+    hello_msg_free(msgs[slots]);
+    hello_test_drain(q);
+    KUNIT_EXPECT_EQ(test, READ_ONCE(q->log_count), slots);
+}
+
+/* Messages refused by a full ring leave a gap in the sequence numbers */
+static void hello_test_seq_gap(struct kunit *test)
+{
+    const int slots = 1 << HELLO_TEST_RING_ORDER;
+    struct hello_queue *q = test->priv;
+    struct hello_msg *msg;
+    u64 last = 0;
+    int i, accepted = 0;
+
+    /* One CPU ring and no worker: everything past the slots is refused */
+    mutex_lock(&q->read_lock);
+    migrate_disable();
+    for (i = 0; i < slots + 3; i++) {
+        msg = hello_msg_alloc(1, GFP_KERNEL);
+        KUNIT_ASSERT_NOT_NULL(test, msg);
+        if (hello_queue_push(q, msg, ktime_get_ns()))
+            hello_msg_free(msg);
+        else
+            accepted++;
+    }
+    migrate_enable();
+    mutex_unlock(&q->read_lock);
+    KUNIT_EXPECT_EQ(test, accepted, slots);
+
+    hello_test_drain(q);
+    while ((msg = hello_test_pop(q))) {
+        last = msg->seq;
+        hello_msg_free(msg);
+    }
+    KUNIT_EXPECT_EQ(test, last, (u64)slots);
+
+    /* The next accepted message follows the three refused ones */
+    KUNIT_EXPECT_EQ(test, hello_store(q, "x", 1), (ssize_t)1);
+    hello_test_drain(q);
+    msg = hello_test_pop(q);
+    KUNIT_ASSERT_NOT_NULL(test, msg);
+    KUNIT_EXPECT_EQ(test, msg->seq, (u64)slots + 4);
+    hello_msg_free(msg);
+}
+
+static void hello_test_retain(struct kunit *test)
+{
+    unsigned int saved = hello_retain_bytes;
+    struct hello_queue *q = test->priv;
+    char buf[64] = {};
+    int i;
+
+    /* The worker stops draining once the log holds retain_bytes */
+    WRITE_ONCE(hello_retain_bytes, 2 * sizeof(buf));
+    for (i = 0; i < 4; i++)
+        KUNIT_EXPECT_EQ(test, hello_store(q, buf, sizeof(buf)), (ssize_t)sizeof(buf));
+    hello_test_drain(q);
+    KUNIT_EXPECT_EQ(test, READ_ONCE(q->log_count), 2);
+
+    /* A full log wakes readers whatever their threshold */
+    KUNIT_EXPECT_TRUE(test, hello_log_ready(q, 100, 0));
+
+    /* Reading makes room, and the reader restarts the worker */
+    hello_test_flush_log(q);
+    hello_queue_kick(q);
+    hello_test_drain(q);
+    KUNIT_EXPECT_EQ(test, READ_ONCE(q->log_count), 2);
+
+    WRITE_ONCE(hello_retain_bytes, saved);
+}
+
+static void hello_test_wakeup(struct kunit *test)
+{
+    struct hello_queue *q = test->priv;
+    char buf[10] = {};
+    int i;
+
+    KUNIT_EXPECT_FALSE(test, hello_log_ready(q, 0, 0));
+
+    for (i = 0; i < 4; i++)
+        hello_store(q, buf, sizeof(buf));
+    hello_test_drain(q);
+
+    KUNIT_EXPECT_TRUE(test, hello_log_ready(q, 0, 0));
+    KUNIT_EXPECT_TRUE(test, hello_log_ready(q, 4, 0));
+    KUNIT_EXPECT_FALSE(test, hello_log_ready(q, 5, 0));
+    KUNIT_EXPECT_TRUE(test, hello_log_ready(q, 0, 40));
+    KUNIT_EXPECT_FALSE(test, hello_log_ready(q, 0, 41));
+    KUNIT_EXPECT_TRUE(test, hello_log_ready(q, 5, 40));
+    KUNIT_EXPECT_FALSE(test, hello_log_ready(q, 5, 41));
+}
+
+static void hello_test_coalesce(struct kunit *test)
+{
+    unsigned int saved_usecs = hello_coalesce_usecs;
+    unsigned int saved_msgs = hello_coalesce_msgs;
+    struct hello_queue *q = test->priv;
+    char buf[8] = {};
+    int i;
+
+    /* A window that only a full batch can close within the test */
+    WRITE_ONCE(hello_coalesce_usecs, USEC_PER_SEC);
+    WRITE_ONCE(hello_coalesce_msgs, 4);
+    for (i = 0; i < 3; i++)
+        hello_store(q, buf, sizeof(buf));
+    hello_test_drain(q);
+    KUNIT_EXPECT_EQ(test, READ_ONCE(q->log_count), 0);
+
+    hello_store(q, buf, sizeof(buf));
+    hello_test_drain(q);
+    KUNIT_EXPECT_EQ(test, READ_ONCE(q->log_count), 4);
+
+    /* Below the batch size, the deadline flushes */
+    WRITE_ONCE(hello_coalesce_usecs, 1000);
+    hello_store(q, buf, sizeof(buf));
+    msleep(20);
+    hello_test_drain(q);
+    KUNIT_EXPECT_EQ(test, READ_ONCE(q->log_count), 5);
+
+    WRITE_ONCE(hello_coalesce_usecs, saved_usecs);
+    WRITE_ONCE(hello_coalesce_msgs, saved_msgs);
+}
+
+/* Queue a TLV message of @tag with a @vlen byte value */
+static int hello_test_push_tlv(struct hello_queue *q, u16 tag, u32 vlen)
+{
+    struct hello_world_tlv tlv = { .type = 1, .tag = tag, .len = vlen };
+    struct hello_msg *msg;
+    int ret;
+
+    msg = hello_msg_alloc(sizeof(tlv) + vlen, GFP_KERNEL);
+    if (!msg)
+        return -ENOMEM;
+    memcpy(msg->data, &tlv, sizeof(tlv));
+    memset(msg->data + sizeof(tlv), 0, vlen);
+
+    ret = hello_msg_set_tlv(msg);
+    if (!ret)
+        ret = hello_queue_push(q, msg, ktime_get_ns());
+    if (ret)
+        hello_msg_free(msg);
+    return ret;
+}
+
+static void hello_test_tlv(struct kunit *test)
+{
+    struct hello_world_tlv tlv = { .tag = 7, .len = 4 };
+    struct hello_queue *q = test->priv;
+    struct hello_msg *msg;
+    char buf[16] = {};
+
+    /* The header must describe the payload exactly */
+    msg = hello_msg_alloc(sizeof(tlv) + 5, GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, msg);
+    memcpy(msg->data, &tlv, sizeof(tlv));
+    KUNIT_EXPECT_EQ(test, hello_msg_set_tlv(msg), -EBADMSG);
+    KUNIT_EXPECT_FALSE(test, msg->flags & HELLO_REC_F_TLV);
+    hello_msg_free(msg);
+
+    KUNIT_EXPECT_EQ(test, hello_test_push_tlv(q, 7, 4), 0);
+    KUNIT_EXPECT_EQ(test, hello_store(q, buf, sizeof(buf)), (ssize_t)sizeof(buf));
+    KUNIT_EXPECT_EQ(test, hello_test_push_tlv(q, 9, 0), 0);
+    KUNIT_EXPECT_EQ(test, hello_test_push_tlv(q, 7, 8), 0);
+    hello_test_drain(q);
+
+    KUNIT_EXPECT_EQ(test, READ_ONCE(q->log_count), 4);
+    KUNIT_EXPECT_TRUE(test, hello_tag_ready(q, 7, 2, 0));
+    KUNIT_EXPECT_FALSE(test, hello_tag_ready(q, 7, 3, 0));
+    KUNIT_EXPECT_TRUE(test, hello_tag_ready(q, 9, 1, 0));
+    KUNIT_EXPECT_FALSE(test, hello_tag_ready(q, 8, 0, 0));
+
+    /* Tag 7 in order, leaving the rest of the log alone */
+    mutex_lock(&q->log_lock);
+    msg = hello_tag_first(q, 7);
+    KUNIT_ASSERT_NOT_NULL(test, msg);
+    KUNIT_EXPECT_EQ(test, msg->seq, 1);
+    KUNIT_EXPECT_EQ(test, msg->len, (u32)sizeof(tlv) + 4);
+    hello_log_del(q, msg);
+    hello_msg_free(msg);
+
+    msg = hello_tag_first(q, 7);
+    KUNIT_ASSERT_NOT_NULL(test, msg);
+    KUNIT_EXPECT_EQ(test, msg->seq, 4);
+    hello_log_del(q, msg);
+    hello_msg_free(msg);
+    KUNIT_EXPECT_NULL(test, hello_tag_first(q, 7));
+    mutex_unlock(&q->log_lock);
+
+    KUNIT_EXPECT_FALSE(test, hello_tag_ready(q, 7, 0, 0));
+    KUNIT_EXPECT_EQ(test, READ_ONCE(q->log_count), 2);
+
+    /* Readers without a filter see what is left, tag 9 included */
+    msg = hello_test_pop(q);
+    KUNIT_ASSERT_NOT_NULL(test, msg);
+    KUNIT_EXPECT_FALSE(test, msg->flags & HELLO_REC_F_TLV);
+    hello_msg_free(msg);
+    msg = hello_test_pop(q);
+    KUNIT_ASSERT_NOT_NULL(test, msg);
+    KUNIT_EXPECT_EQ(test, msg->tag, 9);
+    hello_msg_free(msg);
+    KUNIT_EXPECT_FALSE(test, hello_tag_ready(q, 9, 0, 0));
+}
+
+static void hello_test_rate_limit(struct kunit *test)
+{
+    unsigned int saved_rate = hello_rate_limit;
+    unsigned int saved_burst = hello_rate_burst;
+    /* Never real processes, so their buckets start full */
+    const pid_t flooder = -1, other = -2;
+    int i;
+
+    /* One message per second after a burst of four */
+    WRITE_ONCE(hello_rate_limit, 1);
+    WRITE_ONCE(hello_rate_burst, 4);
+
+    for (i = 0; i < 4; i++)
+        KUNIT_EXPECT_EQ(test, hello_sender_charge(flooder, "flooder", 1), 0);
+    KUNIT_EXPECT_EQ(test, hello_sender_charge(flooder, "flooder", 1), -EAGAIN);
+
+    /* Every sender has a bucket of its own */
+    KUNIT_EXPECT_EQ(test, hello_sender_charge(other, "other", 1), 0);
+
+    WRITE_ONCE(hello_rate_limit, 0);
+    KUNIT_EXPECT_EQ(test, hello_sender_charge(flooder, "flooder", 1), 0);
+
+    WRITE_ONCE(hello_rate_limit, saved_rate);
+    WRITE_ONCE(hello_rate_burst, saved_burst);
+}
+
+static void hello_test_msg_alloc(struct kunit *test)
+{
+    struct hello_msg *small, *large;
+
+    small = hello_msg_alloc(HELLO_MSG_SMALL, GFP_KERNEL);
+    large = hello_msg_alloc(HELLO_MSG_SMALL + 1, GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, small);
+    KUNIT_ASSERT_NOT_NULL(test, large);
+
+    KUNIT_EXPECT_EQ(test, small->len, (u32)HELLO_MSG_SMALL);
+    KUNIT_EXPECT_EQ(test, large->len, (u32)HELLO_MSG_SMALL + 1);
+    /* The payload of a small message must fit its slab object */
+    memset(small->data, 0xa5, HELLO_MSG_SMALL);
+    memset(large->data, 0xa5, HELLO_MSG_SMALL + 1);
+
+    hello_msg_free(small);
+    hello_msg_free(large);
+}
+
+static void hello_test_genl_max(struct kunit *test)
+{
+    u32 data_len = min_t(u32, hello_msg_max, HELLO_WORLD_GENL_DATA_MAX);
+    struct nlattr *nest, *attr;
+    struct hello_msg *msg;
+    struct sk_buff *skb;
+
+    /* Every optional attribute present, as for the largest nest */
+    msg = hello_msg_alloc(hello_msg_max, GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, msg);
+    memset(msg->data, 'g', msg->len);
+    msg->seq = 1;
+    msg->ts_ns = 2;
+    msg->user_ns = 3;
+    msg->flags |= HELLO_REC_F_TLV;
+
+    skb = nlmsg_new(2 * U16_MAX, GFP_KERNEL);
+    if (!skb)
+        hello_msg_free(msg);
+    KUNIT_ASSERT_NOT_NULL(test, skb);
+
+    KUNIT_EXPECT_TRUE(test, hello_genl_put(skb, msg));
+    nest = (struct nlattr *)skb->data;
+    KUNIT_EXPECT_EQ(test, nla_type(nest), HELLO_A_MSG);
+    /* nla_len did not wrap: it covers everything that was put */
+    KUNIT_EXPECT_EQ(test, (u32)nest->nla_len, skb->len);
+    KUNIT_EXPECT_LE(test, skb->len, U16_MAX);
+
+    attr = nla_find_nested(nest, HELLO_MSG_A_DATA);
+    KUNIT_EXPECT_NOT_NULL(test, attr);
+    if (attr)
+        KUNIT_EXPECT_EQ(test, (u32)nla_len(attr), data_len);
+    attr = nla_find_nested(nest, HELLO_MSG_A_LEN);
+    KUNIT_EXPECT_NOT_NULL(test, attr);
+    if (attr)
+        KUNIT_EXPECT_EQ(test, nla_get_u32(attr), msg->len);
+
+    kfree_skb(skb);
+    hello_msg_free(msg);
+}
+
+#ifdef CONFIG_HELLO_WORLD_LZ4
+static void hello_test_lz4(struct kunit *test)
+{
+    const int count = 8;
+    bool saved = hello_compress;
+    struct hello_queue *q = test->priv;
+    struct hello_msg *msg;
+    char buf[100];
+    u64 last = 0, last_ts = 0;
+    int i;
+
+    memset(buf, 'z', sizeof(buf));
+
+    /* Hold the worker off so the whole batch is drained in one run */
+    WRITE_ONCE(hello_compress, true);
+    mutex_lock(&q->read_lock);
+    for (i = 0; i < count; i++)
+        KUNIT_EXPECT_EQ(test, hello_store(q, buf, sizeof(buf)), (ssize_t)sizeof(buf));
+    mutex_unlock(&q->read_lock);
+    hello_test_drain(q);
+    WRITE_ONCE(hello_compress, saved);
+
+    KUNIT_EXPECT_EQ(test, READ_ONCE(q->log_count), count);
+    KUNIT_EXPECT_LT(test, READ_ONCE(q->log_bytes), count * sizeof(buf));
+
+    /*
+     * No room for the records of a reader without timestamps: the block is
+     * split back into messages, which keep theirs for the next reader
+     */
+    mutex_lock(&q->log_lock);
+    msg = list_first_entry(&q->log, struct hello_msg, node);
+    KUNIT_EXPECT_TRUE(test, msg->flags & HELLO_MSG_F_LZ4);
+    KUNIT_EXPECT_EQ(test, hello_lz4_read(q, msg, NULL, 0, false), 0);
+    mutex_unlock(&q->log_lock);
+    KUNIT_EXPECT_EQ(test, READ_ONCE(q->log_count), count);
+    KUNIT_EXPECT_EQ(test, READ_ONCE(q->log_bytes), count * sizeof(buf));
+
+    for (i = 0; (msg = hello_test_pop(q)); i++) {
+        KUNIT_EXPECT_GT(test, msg->seq, last);
+        KUNIT_EXPECT_FALSE(test, msg->flags & HELLO_MSG_F_LZ4);
+        KUNIT_EXPECT_NE(test, msg->ts_ns, 0);
+        KUNIT_EXPECT_GE(test, msg->ts_ns, last_ts);
+        KUNIT_EXPECT_EQ(test, msg->len, (u32)sizeof(buf));
+        KUNIT_EXPECT_EQ(test, memcmp(msg->data, buf, sizeof(buf)), 0);
+        last = msg->seq;
+        last_ts = msg->ts_ns;
+        hello_msg_free(msg);
+    }
+    KUNIT_EXPECT_EQ(test, i, count);
+}
+
+static void hello_test_lz4_corrupt(struct kunit *test)
+{
+    const int count = 8;
+    bool saved = hello_compress;
+    struct hello_queue *q = test->priv;
+    struct hello_world_stats before, after;
+    struct hello_msg *msg;
+    char buf[100];
+    int i;
+
+    memset(buf, 'z', sizeof(buf));
+
+    WRITE_ONCE(hello_compress, true);
+    mutex_lock(&q->read_lock);
+    for (i = 0; i < count; i++)
+        KUNIT_EXPECT_EQ(test, hello_store(q, buf, sizeof(buf)), (ssize_t)sizeof(buf));
+    mutex_unlock(&q->read_lock);
+    hello_test_drain(q);
+    WRITE_ONCE(hello_compress, saved);
+    KUNIT_EXPECT_EQ(test, hello_store(q, buf, sizeof(buf)), (ssize_t)sizeof(buf));
+    hello_test_drain(q);
+
+    /* A block that no longer decompresses is dropped, not read forever */
+    hello_stats_read(&before);
+    mutex_lock(&q->log_lock);
+    msg = list_first_entry(&q->log, struct hello_msg, node);
+    KUNIT_EXPECT_TRUE(test, msg->flags & HELLO_MSG_F_LZ4);
+    memset(msg->data + 2 * sizeof(u32), 0xff, msg->len - 2 * sizeof(u32));
+    KUNIT_EXPECT_EQ(test, hello_lz4_read(q, msg, NULL, SIZE_MAX, false), 0);
+    mutex_unlock(&q->log_lock);
+    hello_stats_read(&after);
+    KUNIT_EXPECT_EQ(test, after.lz4_lost - before.lz4_lost, (u64)count);
+
+    /* The message queued after the block is next */
+    KUNIT_EXPECT_EQ(test, READ_ONCE(q->log_count), 1);
+    msg = hello_test_pop(q);
+    KUNIT_ASSERT_NOT_NULL(test, msg);
+    KUNIT_EXPECT_FALSE(test, msg->flags & HELLO_MSG_F_LZ4);
+    KUNIT_EXPECT_EQ(test, msg->seq, (u64)count + 1);
+    hello_msg_free(msg);
+}
+#endif
+
+static struct kunit_case hello_world_test_cases[] = {
+    KUNIT_CASE(hello_test_store_bounds),
+    KUNIT_CASE(hello_test_order),
+    KUNIT_CASE(hello_test_timestamps),
+    KUNIT_CASE(hello_test_ring_full),
+    KUNIT_CASE(hello_test_seq_gap),
+    KUNIT_CASE(hello_test_retain),
+    KUNIT_CASE(hello_test_wakeup),
+    KUNIT_CASE(hello_test_coalesce),
+    KUNIT_CASE(hello_test_tlv),
+    KUNIT_CASE(hello_test_rate_limit),
+    KUNIT_CASE(hello_test_msg_alloc),
+    KUNIT_CASE(hello_test_genl_max),
+#ifdef CONFIG_HELLO_WORLD_LZ4
+    KUNIT_CASE(hello_test_lz4),
+    KUNIT_CASE(hello_test_lz4_corrupt),
+#endif
+    {}
+};
+
+static struct kunit_suite hello_world_test_suite = {
+    .name = "hello_world",
+    .init = hello_test_init,
+    .exit = hello_test_exit,
+    .test_cases = hello_world_test_cases,
+};
+
+static const size_t hello_bench_sizes[] = { 16, 64, 256, 1024, 4096 };
+
+static void hello_bench_size_desc(const size_t *size, char *desc)
+{
+    snprintf(desc, KUNIT_PARAM_DESC_SIZE, "%zu bytes", *size);
+}
+
+KUNIT_ARRAY_PARAM(hello_bench_size, hello_bench_sizes, hello_bench_size_desc);
+
+/*
+ * Times hello_store(), the whole sysfs store path minus the sysfs core.
+ * Only the stores are timed; the log is emptied between batches so the ring
+ * never fills and every message takes the full path.
+ */
+static void hello_bench_store(struct kunit *test)
+{
+    const size_t size = *(const size_t *)test->param_value;
+    struct hello_queue *q = test->priv;
+    u64 total = 0, best = U64_MAX;
+    char *buf;
+    int i, j;
+
+    buf = kunit_kzalloc(test, size, GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, buf);
+
+    for (i = 0; i < HELLO_BENCH_BATCHES; i++) {
+        u64 start, ns;
+
+        start = ktime_get_ns();
+        for (j = 0; j < HELLO_BENCH_BATCH; j++)
+            hello_store(q, buf, size);
+        ns = ktime_get_ns() - start;
+
+        total += ns;
+        best = min(best, ns);
+        hello_test_flush_log(q);
+    }
+
+    kunit_info(test, "hello_store %zu bytes: %llu ns/op avg, %llu ns/op best batch\n",
+               size, div_u64(total, HELLO_BENCH_BATCHES * HELLO_BENCH_BATCH),
+               div_u64(best, HELLO_BENCH_BATCH));
+}
+
+static int hello_bench_init(struct kunit *test)
+{
+    struct hello_queue *q;
+
+    if (hello_setup())
+        kunit_skip(test, "hello_world setup failed");
+
+    q = kunit_kzalloc(test, sizeof(*q), GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, q);
+    /* Room for a whole batch on one CPU ring */
+    KUNIT_ASSERT_EQ(test, hello_queue_init(q, ilog2(HELLO_BENCH_BATCH) + 1), 0);
+
+    test->priv = q;
+    return 0;
+}
+
+static struct kunit_case hello_world_bench_cases[] = {
+    KUNIT_CASE_PARAM(hello_bench_store, hello_bench_size_gen_params),
+    {}
+};
+
+static struct kunit_suite hello_world_bench_suite = {
+    .name = "hello_world_bench",
+    .init = hello_bench_init,
+    .exit = hello_test_exit,
+    .test_cases = hello_world_bench_cases,
+};
+
+kunit_test_suites(&hello_world_test_suite, &hello_world_bench_suite);
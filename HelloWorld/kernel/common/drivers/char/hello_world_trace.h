@@ -0,0 +1,87 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Tracepoints of the hello_world driver.
+ *
+ * Enable with
+ *   echo 1 > /sys/kernel/tracing/events/hello_world/enable
+ * or record the hello_world events with perfetto. Disabled tracepoints
+ * cost a patched-out branch.
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM hello_world
+
+#if !defined(_HELLO_WORLD_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _HELLO_WORLD_TRACE_H
+
+#include <linux/tracepoint.h>
+
+#include "hello_world_internal.h"
+
+/* Payload bytes copied into a hello_world_msg event */
+#define HELLO_TRACE_DATA_MAX 256
+
+/*
+ * hello_world_msg - the drain worker moved a message to the read log
+ *
+ * Records at most HELLO_TRACE_DATA_MAX payload bytes; len is the full
+ * length.
+ */
+TRACE_EVENT(hello_world_msg,
+
+    TP_PROTO(const struct hello_msg *msg),
+
+    TP_ARGS(msg),
+
+    TP_STRUCT__entry(
+        __field(u64, seq)
+        __field(u32, len)
+        __field(u16, cpu)
+        __dynamic_array(char, data, min_t(u32, msg->len, HELLO_TRACE_DATA_MAX))
+    ),
+
+    TP_fast_assign(
+        __entry->seq = msg->seq;
+        __entry->len = msg->len;
+        __entry->cpu = msg->cpu;
+        memcpy(__get_dynamic_array(data), msg->data,
+               __get_dynamic_array_len(data));
+    ),
+
+    TP_printk("seq=%llu cpu=%u len=%u data=%.*s",
+              __entry->seq, __entry->cpu, __entry->len,
+              __get_dynamic_array_len(data), __get_dynamic_array(data))
+);
+
+/*
+ * hello_world_reject - a message was not queued
+ * @len: payload length
+ * @err: -EINVAL (too large), -ENOSPC (ring full), -EAGAIN (rate limit),
+ *       -ECANCELED (BPF filter) or -ENOMEM
+ */
+TRACE_EVENT(hello_world_reject,
+
+    TP_PROTO(size_t len, int err),
+
+    TP_ARGS(len, err),
+
+    TP_STRUCT__entry(
+        __field(size_t, len)
+        __field(int, err)
+    ),
+
+    TP_fast_assign(
+        __entry->len = len;
+        __entry->err = err;
+    ),
+
+    TP_printk("len=%zu err=%d", __entry->len, __entry->err)
+);
+
+#endif /* _HELLO_WORLD_TRACE_H */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE hello_world_trace
+#include <trace/define_trace.h>
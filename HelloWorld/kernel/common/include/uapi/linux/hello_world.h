@@ -0,0 +1,376 @@
+/* SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note */
+/*
+ * Userspace interface of the hello_world character device (/dev/hello_world).
+ *
+ * A write() queues one message. writev() queues one message per non-empty
+ * iovec, and data spliced in from a pipe is cut into messages of up to
+ * max_msg_size bytes.
+ *
+ * A read() returns as many whole records as fit in the supplied buffer.
+ * Every record starts with a struct hello_world_rec header, followed by
+ * 'len' payload bytes and zero padding up to the next 8-byte boundary.
+ * Records are returned in ascending sequence number order. Payloads can be
+ * as large as the driver's max_msg_size parameter (64 KiB by default), so
+ * the buffer should be sized accordingly.
+ *
+ * With HELLO_READ_F_TS set (HELLO_IOC_SET_READ_FLAGS) each record carries
+ * HELLO_REC_F_TS and a struct hello_world_rec_ts between header and payload.
+ *
+ * Payloads are opaque binary data. A writer that sets HELLO_WRITE_F_TLV
+ * (HELLO_IOC_SET_WRITE_FLAGS) frames each message as a struct
+ * hello_world_tlv; the driver indexes such messages by tag, and a reader
+ * that sets HELLO_IOC_SET_TAG_FILTER only reads and waits for one tag.
+ *
+ * A blocking read() sleeps until the wakeup threshold of the file
+ * (HELLO_IOC_SET_WAKEUP, one message by default) is reached, poll() reports
+ * EPOLLIN on the same condition, and O_ASYNC readers get SIGIO whenever new
+ * messages arrive. /sys/kernel/hello_world/pending can be polled for
+ * sysfs_notify() wakeups as well.
+ *
+ * A process can also mmap() a shared submission ring (see struct
+ * hello_world_sring_hdr) and publish messages with plain stores. The kernel
+ * drains the ring asynchronously; HELLO_IOC_SRING_KICK is only needed when
+ * the kernel has flagged HELLO_SRING_NEED_WAKEUP because it went idle.
+ *
+ * Every message is also multicast on the HELLO_WORLD_GENL_MCGRP group of
+ * the HELLO_WORLD_GENL_NAME generic netlink family, see HELLO_CMD_MSGS.
+ *
+ * Further channels are created with mkdir in configfs, under
+ * HELLO_WORLD_CONFIGFS_ROOT. Each has its own rings and read log behind
+ * /dev/HELLO_WORLD_DEV_NAME-<name> and the same interface as above.
+ */
+#ifndef _UAPI_LINUX_HELLO_WORLD_H
+#define _UAPI_LINUX_HELLO_WORLD_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define HELLO_WORLD_DEV_NAME "hello_world"
+
+/* configfs directory holding one subdirectory per channel */
+#define HELLO_WORLD_CONFIGFS_ROOT "hello_world"
+
+/* Alignment of records returned by read() */
+#define HELLO_WORLD_REC_ALIGN 8
+
+/*
+ * struct hello_world_rec - header of a record returned by read()
+ * @seq: sequence number, consecutive per device. Messages refused on their
+ *       way in (full ring, rate limit, BPF filter, shared ring records the
+ *       driver dropped) use up a number too, so a gap means messages were
+ *       dropped or read by another reader
+ * @len: payload length in bytes (header and padding not included)
+ * @cpu: CPU whose ring buffer queued the message
+ * @flags: HELLO_REC_F_*
+ */
+struct hello_world_rec {
+    __u64 seq;
+    __u32 len;
+    __u16 cpu;
+    __u16 flags;
+};
+
+/* The payload was handed over with HELLO_IOC_SUBMIT_MEMFD */
+#define HELLO_REC_F_MEMFD 0x0001
+/* A struct hello_world_rec_ts follows the header, not counted in len */
+#define HELLO_REC_F_TS 0x0002
+/* The payload is a struct hello_world_tlv and its value */
+#define HELLO_REC_F_TLV 0x0004
+
+/*
+ * struct hello_world_rec_ts - timestamps of a record, see HELLO_READ_F_TS
+ * @accept_ns: CLOCK_MONOTONIC time the driver accepted the message
+ * @user_ns: CLOCK_MONOTONIC time passed by the submitter (HELLO_SREC_TS,
+ *           HELLO_BATCH_USER_TS), 0 if none
+ *
+ * Both are comparable with clock_gettime(CLOCK_MONOTONIC) in the reader, so
+ * submit-to-accept and accept-to-consume latencies need no clock sync.
+ */
+struct hello_world_rec_ts {
+    __u64 accept_ns;
+    __u64 user_ns;
+};
+
+/* Flags of HELLO_IOC_SET_READ_FLAGS, 0 by default */
+#define HELLO_READ_F_TS (1U << 0)
+
+/*
+ * struct hello_world_tlv - framing of a TLV message
+ * @type: meaning of the value, free for the application
+ * @tag: index key, readers can filter on it (HELLO_IOC_SET_TAG_FILTER)
+ * @len: value length in bytes, the value follows the header
+ *
+ * A TLV message is exactly one header and its value: the payload length
+ * must be sizeof(struct hello_world_tlv) + len, or the message is refused
+ * with EBADMSG. Fields are in host byte order.
+ */
+struct hello_world_tlv {
+    __u16 type;
+    __u16 tag;
+    __u32 len;
+};
+
+/* Flags of HELLO_IOC_SET_WRITE_FLAGS, 0 by default */
+/* Every message written, batched or handed over as a memfd is a TLV message */
+#define HELLO_WRITE_F_TLV (1U << 0)
+
+/* Argument of HELLO_IOC_SET_TAG_FILTER that reads every record again */
+#define HELLO_TAG_ANY 0xffffffffU
+
+/*
+ * Shared submission ring
+ *
+ * The mapping starts with one page holding struct hello_world_sring_hdr,
+ * followed by the data area at hdr->data_off. The mmap() length must be the
+ * page size plus a power of two between HELLO_SRING_MIN_SIZE and
+ * HELLO_SRING_MAX_SIZE, offset 0 and MAP_SHARED. Each open file has one ring;
+ * mapping it again must use the same length.
+ *
+ * prod and cons are free-running byte counters, the ring position is the
+ * counter modulo hdr->size. The producer writes a struct hello_world_srec
+ * followed by the payload, padded to HELLO_WORLD_REC_ALIGN, then advances
+ * prod with a release store. A record never wraps: when the space left before
+ * the end of the data area is too small, the producer writes a record with
+ * HELLO_SREC_PAD set, which covers the rest of the area.
+ *
+ * After advancing prod the producer issues a full barrier and reads flags.
+ * If HELLO_SRING_NEED_WAKEUP is set it calls HELLO_IOC_SRING_KICK.
+ * HELLO_SRING_ERROR means the kernel found a malformed record and stopped
+ * draining the ring for good.
+ */
+#define HELLO_SRING_MIN_SIZE 4096
+#define HELLO_SRING_MAX_SIZE (4 << 20)
+
+/* hello_world_sring_hdr.flags */
+#define HELLO_SRING_NEED_WAKEUP (1U << 0)
+#define HELLO_SRING_ERROR (1U << 1)
+
+/*
+ * struct hello_world_sring_hdr - header page of the shared submission ring
+ * @prod: bytes published by userspace
+ * @cons: bytes consumed by the kernel
+ * @flags: HELLO_SRING_* state set by the kernel
+ * @dropped: records the kernel could not queue (too large, malformed TLV or
+ *           queue full)
+ * @size: size of the data area in bytes
+ * @data_off: offset of the data area from the start of the mapping
+ * @msg_max: largest payload the kernel accepts, longer records are dropped;
+ *           a record this long still fits the data area with HELLO_SREC_TS
+ *
+ * The producer and consumer fields are on separate cache lines.
+ */
+struct hello_world_sring_hdr {
+    __u32 prod;
+    __u32 resv0[15];
+    __u32 cons;
+    __u32 flags;
+    __u32 dropped;
+    __u32 resv1[13];
+    __u32 size;
+    __u32 data_off;
+    __u32 msg_max;
+};
+
+/* hello_world_srec.flags */
+#define HELLO_SREC_PAD (1U << 0)
+/* A __u64 CLOCK_MONOTONIC submit time in ns precedes the payload, not
+ * counted in len */
+#define HELLO_SREC_TS (1U << 1)
+/* The payload is a TLV message, malformed ones are dropped */
+#define HELLO_SREC_TLV (1U << 2)
+
+/*
+ * struct hello_world_srec - header of a record in the shared ring
+ * @len: payload length in bytes
+ * @flags: HELLO_SREC_* flags
+ */
+struct hello_world_srec {
+    __u32 len;
+    __u32 flags;
+};
+
+/* Most descriptors accepted by one HELLO_IOC_SUBMIT_BATCH call */
+#define HELLO_WORLD_BATCH_MAX 256
+
+/*
+ * struct hello_world_batch_desc - one message of a batch
+ * @ptr: user address of the payload
+ * @len: payload length in bytes
+ * @status: set by the kernel, 0 if the message was queued, else -errno
+ */
+struct hello_world_batch_desc {
+    __u64 ptr;
+    __u32 len;
+    __s32 status;
+};
+
+/* hello_world_batch.flags: stop at the first failure, later descriptors
+ * get -ECANCELED */
+#define HELLO_BATCH_STOP_ON_ERROR (1U << 0)
+/* descs points to struct hello_world_batch_desc_ts instead */
+#define HELLO_BATCH_USER_TS (1U << 1)
+
+/*
+ * struct hello_world_batch_desc_ts - descriptor with a submit time
+ * @desc: as without HELLO_BATCH_USER_TS
+ * @user_ns: CLOCK_MONOTONIC submit time, reported in hello_world_rec_ts
+ */
+struct hello_world_batch_desc_ts {
+    struct hello_world_batch_desc desc;
+    __u64 user_ns;
+};
+
+/*
+ * struct hello_world_batch - argument of HELLO_IOC_SUBMIT_BATCH
+ * @descs: user address of an array of @count descriptors
+ * @count: number of descriptors, at most HELLO_WORLD_BATCH_MAX
+ * @flags: HELLO_BATCH_* flags
+ *
+ * The ioctl returns the number of messages queued; the status of every
+ * descriptor is written back to the array.
+ */
+struct hello_world_batch {
+    __u64 descs;
+    __u32 count;
+    __u32 flags;
+};
+
+/* Buckets of hello_world_stats.lat_hist */
+#define HELLO_WORLD_LAT_BUCKETS 32
+
+/*
+ * struct hello_world_stats - contents of /sys/kernel/hello_world/stats
+ * @accepted: messages queued
+ * @bytes: payload bytes queued
+ * @rejected_too_large: messages refused with -EINVAL (length out of range)
+ * @rejected_full: messages refused because the CPU ring was full
+ * @rejected_nomem: messages refused because no memory was available
+ * @lat_hist: submission latency of accepted messages; bucket i counts
+ *            latencies in [2^i, 2^(i+1)) ns, the last bucket everything above
+ * @rejected_ratelimited: messages refused because their sender exceeded the
+ *                        rate_limit parameter
+ * @lz4_raw_bytes: payload bytes of drained batches offered to LZ4
+ *                 (compress parameter)
+ * @lz4_stored_bytes: bytes retained for them, compressed or not
+ * @filtered: messages dropped by a BPF program attached to the driver's
+ *            hello_filter_msg() hook
+ * @lz4_lost: messages lost with an LZ4 block that failed to decompress
+ *
+ * Counters are summed over all CPUs when the attribute is read.
+ */
+struct hello_world_stats {
+    __u64 accepted;
+    __u64 bytes;
+    __u64 rejected_too_large;
+    __u64 rejected_full;
+    __u64 rejected_nomem;
+    __u64 lat_hist[HELLO_WORLD_LAT_BUCKETS];
+    __u64 rejected_ratelimited;
+    __u64 lz4_raw_bytes;
+    __u64 lz4_stored_bytes;
+    __u64 filtered;
+    __u64 lz4_lost;
+};
+
+/*
+ * struct hello_world_wakeup - argument of HELLO_IOC_SET_WAKEUP
+ * @msgs: wake once this many messages are waiting, 0 to ignore
+ * @bytes: wake once this many payload bytes are waiting, 0 to ignore
+ *
+ * Whichever threshold is reached first wakes the reader. With both zero
+ * the file falls back to waking on every message. A full read log
+ * (retain_bytes) always wakes, as it cannot grow any further.
+ */
+struct hello_world_wakeup {
+    __u32 msgs;
+    __u32 bytes;
+};
+
+/* Generic netlink family carrying every drained message */
+#define HELLO_WORLD_GENL_NAME "hello_world"
+#define HELLO_WORLD_GENL_VERSION 1
+/* Multicast group, subscribing needs CAP_SYS_ADMIN */
+#define HELLO_WORLD_GENL_MCGRP "msgs"
+
+/*
+ * Payloads above this are truncated, HELLO_MSG_A_LEN keeps the real length.
+ * Leaves room for the other HELLO_MSG_A_* attributes, so the whole HELLO_A_MSG
+ * nest fits the 16-bit nla_len.
+ */
+#define HELLO_WORLD_GENL_DATA_MAX 65452
+
+enum {
+    HELLO_CMD_UNSPEC,
+    /* kernel -> user: one or more HELLO_A_MSG in sequence order */
+    HELLO_CMD_MSGS,
+    __HELLO_CMD_MAX,
+};
+#define HELLO_CMD_MAX (__HELLO_CMD_MAX - 1)
+
+enum {
+    HELLO_A_UNSPEC,
+    HELLO_A_MSG,        /* nested HELLO_MSG_A_* */
+    HELLO_A_CHANNEL,    /* string, absent for /dev/hello_world itself */
+    __HELLO_A_MAX,
+};
+#define HELLO_A_MAX (__HELLO_A_MAX - 1)
+
+enum {
+    HELLO_MSG_A_UNSPEC,
+    HELLO_MSG_A_SEQ,    /* u64, as in struct hello_world_rec */
+    HELLO_MSG_A_CPU,    /* u16 */
+    HELLO_MSG_A_LEN,    /* u32, payload length before truncation */
+    HELLO_MSG_A_DATA,   /* binary, up to HELLO_WORLD_GENL_DATA_MAX bytes */
+    HELLO_MSG_A_PAD,
+    HELLO_MSG_A_TS,     /* u64, hello_world_rec_ts.accept_ns */
+    HELLO_MSG_A_USER_TS, /* u64, hello_world_rec_ts.user_ns, absent if 0 */
+    HELLO_MSG_A_TAG,    /* u16, hello_world_tlv.tag of TLV messages only */
+    __HELLO_MSG_A_MAX,
+};
+#define HELLO_MSG_A_MAX (__HELLO_MSG_A_MAX - 1)
+
+/*
+ * struct hello_world_memfd - argument of HELLO_IOC_SUBMIT_MEMFD
+ * @fd: memfd holding the payload, sealed with F_SEAL_WRITE and F_SEAL_SHRINK
+ * @flags: reserved, zero
+ * @offset: start of the payload in the memfd
+ * @len: payload length, up to the driver's max_msg_size
+ *
+ * The driver keeps the memfd pages and maps them in place instead of copying
+ * the payload; the caller may close @fd as soon as the ioctl returns. The
+ * seals guarantee the pages cannot change or disappear under the driver.
+ */
+struct hello_world_memfd {
+    __s32 fd;
+    __u32 flags;
+    __u64 offset;
+    __u64 len;
+};
+
+#define HELLO_WORLD_IOC_MAGIC 0xB7
+
+/* Wake the kernel consumer of the shared ring */
+#define HELLO_IOC_SRING_KICK _IO(HELLO_WORLD_IOC_MAGIC, 0x01)
+
+/* Queue several messages with one system call */
+#define HELLO_IOC_SUBMIT_BATCH _IOW(HELLO_WORLD_IOC_MAGIC, 0x02, struct hello_world_batch)
+
+/* Set the read()/poll() wakeup threshold of this file */
+#define HELLO_IOC_SET_WAKEUP _IOW(HELLO_WORLD_IOC_MAGIC, 0x03, struct hello_world_wakeup)
+
+/* Queue one message whose payload lives in a sealed memfd */
+#define HELLO_IOC_SUBMIT_MEMFD _IOW(HELLO_WORLD_IOC_MAGIC, 0x04, struct hello_world_memfd)
+
+/* Set the HELLO_READ_F_* flags of this file */
+#define HELLO_IOC_SET_READ_FLAGS _IOW(HELLO_WORLD_IOC_MAGIC, 0x05, __u32)
+
+/* Set the HELLO_WRITE_F_* flags of this file */
+#define HELLO_IOC_SET_WRITE_FLAGS _IOW(HELLO_WORLD_IOC_MAGIC, 0x06, __u32)
+
+/*
+ * Make read() and poll() of this file see only the TLV messages with this
+ * tag (a __u32 up to 0xffff), or every record again with HELLO_TAG_ANY
+ */
+#define HELLO_IOC_SET_TAG_FILTER _IOW(HELLO_WORLD_IOC_MAGIC, 0x07, __u32)
+
+#endif /* _UAPI_LINUX_HELLO_WORLD_H */